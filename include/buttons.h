@@ -19,25 +19,53 @@
 #ifndef __BUTTONS_H_
 #define __BUTTONS_H_
 
-#define SET_BUTTON_PORT		PIND
-#define SET_BUTTON_IDX		7
-#define ADV_BUTTON_PORT		PINC
-#define ADV_BUTTON_IDX		0
+// Button inputs, X(name, PIN register, bit), active low with the pull-ups on
+// Each one gets a bit in the masks below in table order, up to 8 of them. The debounce works on
+// all of them at once so another button only costs reading its pin
+#define BUTTON_TABLE(X) \
+	X(SET,	PIND,	7) \
+	X(ADV,	PINC,	0)
 
-#define NOT_PRESSED		0
-#define SHORT_PRESS		1
-#define LONG_PRESS		2
-#define CONTINUED_PRESS 3
+#define BUTTON_INDEX(name, pins, bit)	BUTTON_##name##_INDEX,
+#define BUTTON_MASK(name, pins, bit)	BUTTON_##name = (1 << BUTTON_##name##_INDEX),
+enum { BUTTON_TABLE(BUTTON_INDEX) BUTTON_COUNT };
+enum { BUTTON_TABLE(BUTTON_MASK) };
 
-#define SHORT_PRESS_TIMEOUT		4
-#define LONG_PRESS_TIMEOUT		56  //96
-#define CONT_PRESS_TIMEOUT		64	//128
+// Timer0 ticks (~32.7ms) a button combination has to be held, counted from when the debounce lets it through
+// The debounce itself takes 4 ticks
+#define BUTTON_LONG_TICKS		52
+#define BUTTON_REPEAT_TICKS		60
+#define BUTTON_IDLE_TICKS		61					// About 2 seconds untouched and Timer0 stops, unless in SET, DATE or MENU
 
-extern volatile uint8_t set_button_counter;
-extern volatile uint8_t adv_button_counter;
-extern volatile uint8_t set_button_flag, adv_button_flag;
-extern volatile uint8_t set_button_holdoff;
+// Repeats start BUTTON_REPEAT_INTERVAL ticks apart and go twice as fast every BUTTON_REPEAT_SPEEDUP of them
+// until there is one every tick
+#define BUTTON_REPEAT_INTERVAL	5
+#define BUTTON_REPEAT_SPEEDUP	8
+#define BUTTON_REPEAT_STALE		(DISPLAY_TICKS_PER_SECOND / 4)	// Older repeats are dropped, in Timer1 ticks
 
+// Button events
+#define BUTTON_NONE		0
+#define BUTTON_PRESS	1
+#define BUTTON_RELEASE	2
+#define BUTTON_LONG		3
+#define BUTTON_REPEAT	4
+
+// Button events waiting for the main loop, must be a power of two
+#define BUTTON_EVENT_QUEUE_SIZE	8
+
+typedef struct _button_event_t {
+	uint8_t		type;
+	uint8_t		buttons;								// Mask of the buttons it happened to
+	uint32_t	time;									// display_timestamp() when it happened
+} button_event_t;
+
+extern volatile uint8_t button_state;					// Debounced, a bit is set while the button is down
+
+uint8_t button_event_pop(button_event_t *event);
+uint8_t button_event_pending(void);
 void init_event_timer(void);
+void button_poll_start(void);
+void button_poll_stop(void);
+void button_wake(void);
 
 #endif // __BUTTONS_H_
\ No newline at end of file
@@ -0,0 +1,35 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#ifndef __CALENDAR_H_
+#define __CALENDAR_H_
+
+#include <stdint.h>
+
+// Years are counted from 2000, which starts a 400 year leap cycle, and days from 1/1/2000
+// A 16 bit day count is good through 2179, the 32 bit RTC second count through 2135
+#define CALENDAR_EPOCH_YEAR		2000
+#define CALENDAR_EPOCH_DAY		6				// 1/1/2000 was a Saturday
+
+uint8_t calendar_is_leap(uint16_t year);
+uint8_t calendar_days_in_month(uint16_t year, uint8_t month);
+uint16_t calendar_days(uint16_t year, uint8_t month, uint8_t date);
+uint8_t calendar_day_of_week(uint16_t days);
+void calendar_date(uint16_t days, uint16_t *year, uint8_t *month, uint8_t *date);
+
+#endif // __CALENDAR_H_
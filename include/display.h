@@ -17,7 +17,7 @@
 // along with this program.  If not, see <http:#www.gnu.org/licenses/>.
 
 #ifndef __DISPLAY_H_
-#define __DISPLAY
+#define __DISPLAY_H_
 
 #include <avr/io.h>
 
@@ -72,6 +72,28 @@
 #define rcol_pin		PD1
 #define lcol_pin		PB0
 
+// Every display pin on each port, used to mask whole port writes
+#define PORTA_DISPLAY_MASK	(HOUR_TEN_MASK | HOUR_ONE_MASK)
+#define PORTB_DISPLAY_MASK	(MIN_TEN_MASK | MIN_ONE_MASK | LCOL_MASK)
+#define PORTC_DISPLAY_MASK	(SEC_ONE_MASK)
+#define PORTD_DISPLAY_MASK	(SEC_TEN_MASK | _BV(min_one_a) | RCOL_MASK)
+
+// Pins that are not part of the display but live on the same ports, carried in every frame
+#define PORTA_STATIC		0x00
+#define PORTB_STATIC		0x00
+#define PORTC_STATIC		(_BV(PC0) | _BV(PC6))		// Adv button pull-up, 32.768KHz xtal
+#define PORTD_STATIC		(_BV(PD2) | _BV(PD7))		// Power fail sense and Set button pull-ups
+
+// BCD digit to port bits, a is the 1's bit through d the 8's bit
+#define BCD_BITS(n, a, b, c, d)	((((n) & 1)?_BV(a):0) | (((n) & 2)?_BV(b):0) | (((n) & 4)?_BV(c):0) | (((n) & 8)?_BV(d):0))
+#define HOUR_TEN_BCD(n)		BCD_BITS(n, hour_ten_a, hour_ten_b, hour_ten_c, hour_ten_d)
+#define HOUR_ONE_BCD(n)		BCD_BITS(n, hour_one_a, hour_one_b, hour_one_c, hour_one_d)
+#define MIN_TEN_BCD(n)		BCD_BITS(n, min_ten_a, min_ten_b, min_ten_c, min_ten_d)
+#define MIN_ONE_BCD(n)		(BCD_BITS(n, min_one_a, min_one_b, min_one_c, min_one_d) & MIN_ONE_MASK)
+#define MIN_ONE_A_BCD(n)	(((n) & 1)?_BV(min_one_a):0)		// 'a' is on PORTD
+#define SEC_TEN_BCD(n)		BCD_BITS(n, sec_ten_a, sec_ten_b, sec_ten_c, sec_ten_d)
+#define SEC_ONE_BCD(n)		BCD_BITS(n, sec_one_a, sec_one_b, sec_one_c, sec_one_d)
+
 // Set mode stuff
 #define HOUR_SET		1
 #define MIN_SET			2
@@ -80,17 +102,47 @@
 #define DATE_SET		5
 #define YEAR_SET		6
 
+// Timer1 PWM, the 8 bit duty cycle and fade values are scaled onto a 13 bit period
+#define DISPLAY_PWM_TOP			0x1FFF
+#define DISPLAY_PWM_SHIFT		5
+#define DISPLAY_PWM_COMPARE(v)	((uint16_t)(v) << DISPLAY_PWM_SHIFT)
+#define DISPLAY_TIMSK			((1 << TOIE1) | (1 << OCIE1B))	// Compare A is only on during a fade
+#define DISPLAY_TICKS_PER_SECOND	(F_CPU / 8)		// Timer1 runs from clk/8
+#define DISPLAY_TIMESTAMP_MASK	((65536UL * (DISPLAY_PWM_TOP + 1)) - 1)	// display_timestamp() wraps with the 16 bit period count
+
+// Startup sweep, digits 0-9 then back to the frame buffers
+#define DISPLAY_EXERCISE_DONE	10
+
+// One complete set of port values, written by the display ISRs as is
+typedef struct _display_frame_t {
+	uint8_t		porta;
+	uint8_t		portb;
+	uint8_t		portc;
+	uint8_t		portd;
+} display_frame_t;
+
+// What the display ISRs draw during one PWM period
+typedef struct _display_buffer_t {
+	display_frame_t	old_digits;					// From the start of the period until compare A
+	display_frame_t	new_digits;					// From compare A until the duty cycle compare
+	uint8_t			fade;						// Crossfade from old to new, otherwise new only
+} display_buffer_t;
+
 extern volatile uint8_t display_state;					// time or date, probably get rid of this...
 
 // Stuff used in fading and whatnot
 extern volatile uint8_t override_pwm;					// Force full brightness, for use in menus and set mode
 extern volatile uint8_t display_duty_cycle;				// brightness
 extern volatile uint8_t display_new[3];					// 0: Hours 1: Minutes 2: Seconds
-extern volatile uint8_t display_old[3];					// 0: Hours 1: Minutes 2: Seconds
 extern volatile uint8_t display_colons;
 
 void init_pwm_timer(void);
-void display_blank_digits(uint8_t digits);
-void display_set_digits(uint8_t hour, uint8_t minute, uint8_t second, uint8_t colon);
+void display_blank_digits(display_frame_t *frame, uint8_t digits);
+void display_set_digits(display_frame_t *frame, uint8_t hour, uint8_t minute, uint8_t second, uint8_t colon);
+void display_update(uint8_t blank);
+void display_exercise(uint16_t step_ms);
+uint8_t display_exercising(void);
+uint32_t display_timestamp(void);
+uint32_t display_elapsed(uint32_t since);
 
 #endif // __DISPLAY_H_
\ No newline at end of file
@@ -0,0 +1,33 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#ifndef __DST_H_
+#define __DST_H_
+
+#include <stdint.h>
+
+// Week 5 in the settings means the last one of the month
+#define DST_LAST_WEEK	5
+#define DST_NEVER		0xFFFFFFFF
+
+extern uint32_t dst_next;					// rtc_seconds of the next transition
+
+void dst_schedule(uint32_t after);
+void dst_transition(void);
+
+#endif // __DST_H_
@@ -0,0 +1,97 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+#ifndef __ISRSTATS_H_
+#define __ISRSTATS_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "../include/display.h"
+
+// Interrupt timing, only built in with make ISR_STATS=1, otherwise ISR_STATS_BEGIN() is nothing
+// An instrumented ISR is timed on TCNT1 from the ISR_STATS_BEGIN() at its top to its return, so the
+// prologue and epilogue the compiler adds aren't counted. TCNT1 ticks are 8 CPU cycles
+// None of the ISRs turn interrupts back on, so they never nest and each one's time is its own
+
+#define ISR_STATS_TIMER1_OVF	0
+#define ISR_STATS_TIMER1_COMPA	1
+#define ISR_STATS_TIMER1_COMPB	2
+#define ISR_STATS_TIMER2_OVF	3
+#define ISR_STATS_TIMER2_COMP	4
+#define ISR_STATS_TIMER0_OVF	5
+#define ISR_STATS_VECTORS		6
+
+// Read only menu options after the regular ones, one per vector in the order above
+// Adv steps through the pages, shown on the colons: max, average, min cycles then overruns
+#define ISR_STATS_MENU_FIRST	26
+#define ISR_STATS_PAGES			4
+
+#ifdef ISR_STATS
+
+#define ISR_STATS_MENU_OPTIONS	ISR_STATS_VECTORS
+
+typedef struct _isr_stats_t {
+	uint16_t	min;									// Timer1 ticks
+	uint16_t	max;
+	uint32_t	sum;
+	uint16_t	count;									// Halved along with sum when it wraps
+	uint16_t	overruns;								// Its own flag was set again before it returned
+} isr_stats_t;
+
+typedef struct _isr_stats_frame_t {
+	uint8_t		vector;
+	uint8_t		flag;									// TIFR bit that fires it
+	uint16_t	start;
+} isr_stats_frame_t;
+
+extern isr_stats_t isr_stats[ISR_STATS_VECTORS];
+
+static inline __attribute__ ((always_inline)) void isr_stats_exit(isr_stats_frame_t *frame) {
+	// Runs when the ISR returns, TOP is one less than a power of two so the mask handles the wrap
+	isr_stats_t *stats = &isr_stats[frame->vector];
+	uint16_t ticks = (TCNT1 - frame->start) & DISPLAY_PWM_TOP;
+
+	if ((!stats->count) || (ticks < stats->min))
+		stats->min = ticks;
+	if (ticks > stats->max)
+		stats->max = ticks;
+	stats->sum += ticks;
+	if (++stats->count == 0) {
+		stats->count = 0x8000;
+		stats->sum >>= 1;
+	}
+	if (TIFR & frame->flag)
+		stats->overruns++;
+}
+
+#define ISR_STATS_BEGIN(vector, flag) \
+	isr_stats_frame_t isr_stats_frame __attribute__ ((cleanup (isr_stats_exit))) = { vector, flag, TCNT1 }
+
+void isr_stats_read(uint8_t field_values[2], uint8_t vector);
+void isr_stats_next_page(void);
+
+#else
+
+#define ISR_STATS_MENU_OPTIONS	0
+#define ISR_STATS_BEGIN(vector, flag)
+
+#endif // ISR_STATS
+
+#endif // __ISRSTATS_H_
@@ -21,6 +21,7 @@
 
 // Constants for the power fail sense pin PD2
 #define PF_PORT		PORTD
+#define PF_PINS		PIND
 #define PF_PIN		2
 
 // Constants for the clock and display state machines
@@ -36,11 +37,7 @@
 #define TRUE		1
 #define FALSE		0
 
-#define MAGIC_NUMBER 5
-
-#include <avr/eeprom.h>
-
-// 26 of 64 bytes in EEPROM used
+// Stored by settings.c, see settings.h for the layout
 typedef struct _clock_settings_t {
 	uint8_t 	clock_display_24hr;
 	uint8_t 	leading_zero_blank;
@@ -66,31 +63,34 @@ typedef struct _clock_settings_t {
 	uint8_t		fall_back_month;
 	uint8_t		pwm_freq;
 	int16_t		software_time_correction;
-	uint8_t		magic_number;
 } clock_settings_t;
 
 extern volatile clock_settings_t clock_settings;
-extern volatile EEMEM clock_settings_t clock_settings_eeprom;
 extern volatile uint8_t set_mode;
 extern volatile uint8_t clock_state;
-extern volatile int8_t correction_flag;
-extern volatile uint32_t correction_counter;			
-extern volatile uint32_t correction_value;
 extern volatile uint8_t inc_dec, swap;
-volatile uint8_t menu_option;
+extern volatile uint8_t loop_wakeup;					// Set by the ISRs when the main loop has something to do
+extern volatile uint8_t power_failed;
+extern volatile uint32_t loop_awake_cycles;				// CPU cycles the main loop was awake for during the last second
+extern volatile uint8_t menu_option;
 
 int main(void);
-void exercise_display(uint16_t delay_ms);
 void cathode_poison_routine(void);
+uint8_t cathode_poison_due(void);
 void init_pins(void);
 void WriteDefaultSettings(void);
-void UpdateSettings(clock_settings_t a);
 void read_menu_setting(uint8_t field_values[2], uint8_t menu_option);
 void increment_menu_setting(uint8_t menu_option, uint8_t speed);
 void increment_time_date(uint8_t set_mode);
 void update_display(void);
 void set_display_duty_cycle(uint8_t brightness);
-uint8_t calculate_day_of_week(void);
-clock_settings_t ReadEEPROM(void);
+void wait_for_event(void);
+void dst_task(void);
+void colon_task(void);
+void time_task(void);
+void date_flash_task(void);
+void refresh_task(void);
+void menu_timeout_task(void);
+void load_task(void);
 
 #endif // __NIXIE_H_
\ No newline at end of file
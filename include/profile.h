@@ -0,0 +1,72 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+#ifndef __PROFILE_H_
+#define __PROFILE_H_
+
+#include <stdint.h>
+
+// Main loop profiler, only built in with make PROFILE=1, otherwise the PROFILE_ macros are nothing
+// Everything is in one block, profile, so it can be read out in one go with the debugger
+// It lives in .noinit so it is still there to read after a reset that wasn't power on
+
+#define PROFILE_EVENTS		5					// The RTC events QRTR_SECOND to SECOND, then the buttons
+#define PROFILE_BUTTON		4
+#define PROFILE_BUCKETS		16
+#define PROFILE_SHIFT		6					// Bucket 0 is under 64us, each after is twice as wide, the last is over a second
+#define PROFILE_MAGIC		0x464F5250UL		// "PROF" in a dump
+
+#ifdef PROFILE
+
+typedef struct _profile_t {
+	uint32_t	magic;
+	uint16_t	size;										// sizeof(profile_t), in case the layout changes
+	uint16_t	latency[PROFILE_EVENTS][PROFILE_BUCKETS];	// Queued to picked up by the main loop, log2 histogram
+	uint32_t	latency_max[PROFILE_EVENTS];				// Timer1 ticks
+	uint16_t	loops;										// Main loop passes so far this second
+	uint16_t	loops_per_second;							// Passes in the last whole second
+	uint16_t	loops_per_second_max;
+	uint32_t	longest_loop;								// Timer1 ticks from waking to going back to sleep
+	uint32_t	boot_latency;								// Timer1 ticks from it starting until the RTC had a good time, last boot
+} profile_t;
+
+extern profile_t profile;
+
+void profile_init(void);
+void profile_latency(uint8_t type, uint32_t since);
+void profile_loop(uint32_t start);
+void profile_second(void);
+
+#define PROFILE_INIT()					profile_init()
+#define PROFILE_LATENCY(type, since)	profile_latency(type, since)
+#define PROFILE_LOOP(start)				profile_loop(start)
+#define PROFILE_SECOND()				profile_second()
+#define PROFILE_BOOT(ticks)				(profile.boot_latency = (ticks))
+
+#else
+
+#define PROFILE_INIT()
+#define PROFILE_LATENCY(type, since)
+#define PROFILE_LOOP(start)
+#define PROFILE_SECOND()
+#define PROFILE_BOOT(ticks)
+
+#endif // PROFILE
+
+#endif // __PROFILE_H_
@@ -25,6 +25,17 @@
 #define TQRT_SECOND	3
 #define SECOND		4
 
+// RTC events waiting for the main loop, must be a power of two
+#define RTC_EVENT_QUEUE_SIZE	16
+
+// Software time correction, the setting is in hundredths of a second per week
+// Timer2 counts 256 ticks a second and is trimmed by a single tick at a time
+#define RTC_TICKS_PER_SECOND	256
+#define RTC_CORRECTION_PERIOD	60480000UL			// Hundredths of a second in a week
+
+// Timer2 writes still on their way to the 32kHz side, power save has to wait for these to clear
+#define RTC_ASSR_BUSY			((1<<TCN2UB)|(1<<OCR2UB)|(1<<TCR2UB))
+
 typedef struct _timespec_t {
     uint16_t year;
     uint8_t  month;
@@ -35,14 +46,23 @@ typedef struct _timespec_t {
     uint8_t  second;
 } timespec_t;
 
-extern volatile timespec_t clock;
+extern volatile uint32_t rtc_seconds;
+extern volatile uint32_t correction_phase;
+extern timespec_t clock;
 extern volatile uint8_t set_timer;
-extern volatile uint8_t sentinal;
-extern volatile uint8_t unlock_correction;
-extern volatile int8_t correction;
-extern volatile int8_t dst_handled;
+extern volatile uint16_t rtc_event_late;				// Events queued while older ones were still waiting
+extern volatile uint16_t rtc_event_overflows;			// Events lost because the queue was full
+extern volatile uint8_t rtc_event_max_depth;			// Deepest the queue has been
 
-extern char not_leap(void);
 extern void init_rtc(void);
+extern uint32_t rtc_now(void);
+extern void rtc_sync(void);
+extern void rtc_set_clock(void);
+extern void rtc_restore(uint32_t seconds, uint32_t phase);
+extern uint8_t rtc_resume(void);
+extern void rtc_adjust(int32_t seconds);
+extern void rtc_set_correction(int16_t correction);
+extern uint8_t rtc_event_pop(void);
+extern uint8_t rtc_event_pending(void);
 
 #endif // __RTC_H_
\ No newline at end of file
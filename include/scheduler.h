@@ -0,0 +1,44 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#ifndef __SCHEDULER_H_
+#define __SCHEDULER_H_
+
+#include <stdint.h>
+
+// Periods and phases are in RTC ticks, one tick is a quarter second
+// Periods must be a power of two, phase 0 is the start of a second
+#define TICKS_PER_SECOND	4
+#define MAX_TASKS			10
+
+typedef struct _task_t {
+	void		(*run)(void);
+	uint8_t		period;
+	uint8_t		phase;
+	uint16_t	runs;						// How many times it has been dispatched
+	uint16_t	wcet;						// Longest run, in Timer1 ticks (1us)
+} task_t;
+
+extern task_t tasks[MAX_TASKS];
+extern uint8_t task_count;
+extern uint8_t scheduler_tick;				// Tick being dispatched, phase within the second is the low two bits
+
+void scheduler_add(void (*run)(void), uint8_t period, uint8_t phase);
+void scheduler_dispatch(uint8_t event);
+
+#endif // __SCHEDULER_H_
@@ -0,0 +1,81 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#ifndef __SETTINGS_H_
+#define __SETTINGS_H_
+
+#include <stdint.h>
+
+// Settings journal, every commit goes to the slot after the newest one so the writes rotate
+// through the EEPROM and the record being replaced is never touched
+// There's no record of which fields changed, EE_RDY reads each byte back and skips the ones that match
+// Each slot holds:
+//		0	sequence number, low byte first, the highest valid one is the current record
+//		2	layout version of the payload
+//		3	clock_settings_t
+//		30	CRC16 of bytes 0-29, written last so a half written record never checks out
+#define SETTINGS_BASE			0x000
+#define SETTINGS_SLOT_SIZE		32
+#define SETTINGS_SLOTS			12					// 0x000 - 0x17F, the top 128 bytes are left free
+#define SETTINGS_SEQ			0
+#define SETTINGS_VERSION_OFFSET	2
+#define SETTINGS_PAYLOAD		3
+#define SETTINGS_CRC			(SETTINGS_SLOT_SIZE - 2)
+#define SETTINGS_PAYLOAD_MAX	(SETTINGS_CRC - SETTINGS_PAYLOAD)
+
+// Bump this when clock_settings_t changes and teach settings_migrate() the old layout
+#define SETTINGS_VERSION		1
+
+// The block from before the journal, clock_settings_t followed by a magic number at address 0
+#define SETTINGS_LEGACY_ADDR	0x000
+#define SETTINGS_LEGACY_MAGIC	5
+#define SETTINGS_LEGACY_MAGIC_ADDR	(SETTINGS_LEGACY_ADDR + 25)
+
+// Power fail time snapshots, rotating through the top 128 bytes
+//		0	rtc_seconds, low byte first
+//		4	correction phase >> SNAPSHOT_PHASE_SHIFT
+//		6	sequence number, the highest valid one is the newest
+//		7	CRC8 of bytes 0-6, written last
+#define SNAPSHOT_BASE			0x180
+#define SNAPSHOT_SIZE			8
+#define SNAPSHOT_SLOTS			16
+#define SNAPSHOT_PHASE			4
+#define SNAPSHOT_PHASE_SHIFT	10
+#define SNAPSHOT_SEQ			6
+#define SNAPSHOT_CHECK			7
+#define SNAPSHOT_REFRESH		600					// Seconds between snapshots while on the supercap
+
+// Worst case from the power fail edge until the snapshot is down: the byte a settings commit has
+// in flight and then every byte of the snapshot. The ATmega16 always erases and writes together,
+// 8.5ms a byte, there is no way to erase a slot ahead of time
+#define EEPROM_WRITE_US			8500UL
+#define SNAPSHOT_WORST_US		((SNAPSHOT_SIZE + 1) * EEPROM_WRITE_US)
+#define SNAPSHOT_BUDGET_US		100000UL			// What the supply holds up for with the tubes off
+
+extern volatile uint8_t settings_writing;			// A commit or snapshot is still going to EEPROM
+extern volatile uint8_t settings_dirty;				// clock_settings changed since the last commit
+
+uint8_t settings_load(void);
+void settings_changed(void);
+void settings_commit(void);
+void snapshot_write(void);
+void snapshot_task(void);
+uint8_t snapshot_init(void);
+uint8_t snapshot_restore(void);
+
+#endif // __SETTINGS_H_
@@ -0,0 +1,41 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Host stand in for <avr/eeprom.h>, the EEPROM is an array in the simulator
+
+#ifndef __SIM_AVR_EEPROM_H_
+#define __SIM_AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define EEMEM
+
+extern uint8_t sim_eeprom[512];
+
+static inline uint8_t eeprom_read_byte(const uint8_t *address) {
+	return sim_eeprom[(uintptr_t)address & 511];
+}
+
+static inline void eeprom_read_block(void *destination, const void *source, size_t size) {
+	memcpy(destination, &sim_eeprom[(uintptr_t)source & 511], size);
+}
+
+#endif // __SIM_AVR_EEPROM_H_
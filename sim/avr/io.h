@@ -0,0 +1,204 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Host stand in for <avr/io.h>, used by make sim
+// The I/O registers are bytes in sim_io_space at their ATmega16 data addresses. Every access goes
+// through sim_io8()/sim_io16(), the ones the simulator watches (timers, flags, EEPROM) are handed
+// over so it can see what the last one wrote and keep them up to date, the rest are plain memory.
+// The firmware reads and writes them the same as on the chip
+
+#ifndef __SIM_AVR_IO_H_
+#define __SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+#define SIM_IO_SIZE		0x60
+
+extern uint8_t sim_io_space[SIM_IO_SIZE];
+extern uint8_t sim_watched[SIM_IO_SIZE];
+extern int16_t sim_accessed;
+
+void sim_access(uint8_t address, uint8_t size);
+
+static inline volatile uint8_t *sim_io8(uint8_t address) {
+	if ((sim_accessed >= 0) || (sim_watched[address]))
+		sim_access(address, 1);
+	return (volatile uint8_t *)&sim_io_space[address];
+}
+
+static inline volatile uint16_t *sim_io16(uint8_t address) {
+	if ((sim_accessed >= 0) || (sim_watched[address]))
+		sim_access(address, 2);
+	return (volatile uint16_t *)&sim_io_space[address];
+}
+
+#define _SFR_MEM8(address)		(*sim_io8(address))
+#define _SFR_MEM16(address)		(*sim_io16(address))
+#define _BV(bit)				(1 << (bit))
+
+#define PIND		_SFR_MEM8(0x30)
+#define DDRD		_SFR_MEM8(0x31)
+#define PORTD		_SFR_MEM8(0x32)
+#define PINC		_SFR_MEM8(0x33)
+#define DDRC		_SFR_MEM8(0x34)
+#define PORTC		_SFR_MEM8(0x35)
+#define PINB		_SFR_MEM8(0x36)
+#define DDRB		_SFR_MEM8(0x37)
+#define PORTB		_SFR_MEM8(0x38)
+#define PINA		_SFR_MEM8(0x39)
+#define DDRA		_SFR_MEM8(0x3A)
+#define PORTA		_SFR_MEM8(0x3B)
+#define EECR		_SFR_MEM8(0x3C)
+#define EEDR		_SFR_MEM8(0x3D)
+#define EEAR		_SFR_MEM16(0x3E)
+#define EEARL		_SFR_MEM8(0x3E)
+#define EEARH		_SFR_MEM8(0x3F)
+#define WDTCR		_SFR_MEM8(0x41)
+#define ASSR		_SFR_MEM8(0x42)
+#define OCR2		_SFR_MEM8(0x43)
+#define TCNT2		_SFR_MEM8(0x44)
+#define TCCR2		_SFR_MEM8(0x45)
+#define ICR1		_SFR_MEM16(0x46)
+#define ICR1L		_SFR_MEM8(0x46)
+#define ICR1H		_SFR_MEM8(0x47)
+#define OCR1B		_SFR_MEM16(0x48)
+#define OCR1BL		_SFR_MEM8(0x48)
+#define OCR1BH		_SFR_MEM8(0x49)
+#define OCR1A		_SFR_MEM16(0x4A)
+#define OCR1AL		_SFR_MEM8(0x4A)
+#define OCR1AH		_SFR_MEM8(0x4B)
+#define TCNT1		_SFR_MEM16(0x4C)
+#define TCNT1L		_SFR_MEM8(0x4C)
+#define TCNT1H		_SFR_MEM8(0x4D)
+#define TCCR1B		_SFR_MEM8(0x4E)
+#define TCCR1A		_SFR_MEM8(0x4F)
+#define SFIOR		_SFR_MEM8(0x50)
+#define TCNT0		_SFR_MEM8(0x52)
+#define TCCR0		_SFR_MEM8(0x53)
+#define MCUCSR		_SFR_MEM8(0x54)
+#define MCUCR		_SFR_MEM8(0x55)
+#define TIFR		_SFR_MEM8(0x58)
+#define TIMSK		_SFR_MEM8(0x59)
+#define GIFR		_SFR_MEM8(0x5A)
+#define GICR		_SFR_MEM8(0x5B)
+#define OCR0		_SFR_MEM8(0x5C)
+#define SREG		_SFR_MEM8(0x5F)
+
+// Port pins
+#define PA0		0
+#define PA1		1
+#define PA2		2
+#define PA3		3
+#define PA4		4
+#define PA5		5
+#define PA6		6
+#define PA7		7
+#define PB0		0
+#define PB1		1
+#define PB2		2
+#define PB3		3
+#define PB4		4
+#define PB5		5
+#define PB6		6
+#define PB7		7
+#define PC0		0
+#define PC1		1
+#define PC2		2
+#define PC3		3
+#define PC4		4
+#define PC5		5
+#define PC6		6
+#define PC7		7
+#define PD0		0
+#define PD1		1
+#define PD2		2
+#define PD3		3
+#define PD4		4
+#define PD5		5
+#define PD6		6
+#define PD7		7
+
+// TIMSK and TIFR
+#define OCIE2	7
+#define TOIE2	6
+#define TICIE1	5
+#define OCIE1A	4
+#define OCIE1B	3
+#define TOIE1	2
+#define OCIE0	1
+#define TOIE0	0
+#define OCF2	7
+#define TOV2	6
+#define ICF1	5
+#define OCF1A	4
+#define OCF1B	3
+#define TOV1	2
+#define OCF0	1
+#define TOV0	0
+
+// Timers
+#define CS02	2
+#define CS01	1
+#define CS00	0
+#define WGM11	1
+#define WGM10	0
+#define WGM13	4
+#define WGM12	3
+#define CS12	2
+#define CS11	1
+#define CS10	0
+#define CS22	2
+#define CS21	1
+#define CS20	0
+#define AS2		3
+#define TCN2UB	2
+#define OCR2UB	1
+#define TCR2UB	0
+
+// MCUCR, MCUCSR, GICR and GIFR
+#define SE		6
+#define SM2		7
+#define SM1		5
+#define SM0		4
+#define ISC11	3
+#define ISC10	2
+#define ISC01	1
+#define ISC00	0
+#define JTRF	4
+#define WDRF	3
+#define BORF	2
+#define EXTRF	1
+#define PORF	0
+#define INT1	7
+#define INT0	6
+#define INT2	5
+#define INTF1	7
+#define INTF0	6
+#define INTF2	5
+
+// EECR
+#define EERIE	3
+#define EEMWE	2
+#define EEWE	1
+#define EERE	0
+
+#define E2END	511
+#define RAMEND	0x45F
+
+#endif // __SIM_AVR_IO_H_
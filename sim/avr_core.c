@@ -0,0 +1,644 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Small ATmega16 instruction set simulator for make cycles
+// Enough of the AVR core for what avr-gcc generates, the enhanced core with mul and movw but no
+// elpm or extended jumps, one instruction at a time with its cycle count
+
+#include <stdint.h>
+#include <string.h>
+
+#include "avr_core.h"
+
+#define R(n)		(avr->data[n])
+#define SREG		(avr->data[AVR_SREG])
+#define FLAG(f)		((SREG >> (f)) & 1)
+#define BIT(v, b)	(((v) >> (b)) & 1)
+
+static void avr_flag(avr_t *avr, uint8_t flag, uint8_t value) {
+	if (value)
+		SREG |= (1 << flag);
+	else
+		SREG &= ~(1 << flag);
+}
+
+static void avr_nzs(avr_t *avr, uint8_t result) {
+	// N and Z from the result and S from N and V, which has to be set already
+	avr_flag(avr, AVR_SREG_N, BIT(result, 7));
+	avr_flag(avr, AVR_SREG_Z, result == 0);
+	avr_flag(avr, AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+}
+
+uint16_t avr_sp(const avr_t *avr) {
+	return avr->data[AVR_SPL] | (avr->data[AVR_SPH] << 8);
+}
+
+static void avr_set_sp(avr_t *avr, uint16_t sp) {
+	avr->data[AVR_SPL] = sp;
+	avr->data[AVR_SPH] = sp >> 8;
+}
+
+void avr_timer2_busy(avr_t *avr, uint8_t bits) {
+	// Start the ASSR busy bits as if the matching Timer2 registers were just written
+	uint8_t i;
+
+	for (i = 0; i < 3; i++)
+		if (bits & (1 << i))
+			avr->assr_until[i] = avr->cycles + AVR_TOSC_UPDATE;
+}
+
+static uint8_t avr_read(avr_t *avr, uint16_t address) {
+	uint8_t value, i;
+
+	if (address >= AVR_DATA_SIZE) {
+		avr->fault = "read outside SRAM";
+		return 0;
+	}
+	value = avr->data[address];
+	if (address == AVR_ASSR) {
+		value &= ~AVR_ASSR_BUSY;
+		for (i = 0; i < 3; i++)
+			if (avr->cycles < avr->assr_until[i])
+				value |= 1 << i;
+	}
+	return value;
+}
+
+static void avr_write(avr_t *avr, uint16_t address, uint8_t value) {
+	// The interrupt flags clear when a one is written, the EEPROM starts on EERE or EEWE and
+	// Timer2 writes go busy while it's asynchronous
+	uint16_t ee;
+
+	if (address >= AVR_DATA_SIZE) {
+		avr->fault = "write outside SRAM";
+		return;
+	}
+	switch (address) {
+		case AVR_TIFR:
+		case AVR_GIFR:
+			avr->data[address] &= ~value;
+			return;
+		case AVR_EECR:
+			ee = (avr->data[AVR_EEARL] | (avr->data[AVR_EEARH] << 8)) & (AVR_EEPROM_SIZE - 1);
+			if (value & (1 << 0)) {
+				avr->data[AVR_EEDR] = avr->eeprom[ee];		// EERE, the CPU stops for 4 cycles
+				avr->cycles += 4;
+			}
+			if ((value & (1 << 1)) && (avr->cycles <= avr->eemwe_until)) {
+				avr->eeprom[ee] = avr->data[AVR_EEDR];		// EEWE, 2 cycles and the write is done
+				avr->cycles += 2;
+			}
+			if (value & (1 << 2))
+				avr->eemwe_until = avr->cycles + 4;
+			avr->data[address] = value & (1 << 3);			// Only EERIE stays set
+			return;
+		case AVR_ASSR:
+			avr->data[address] = value & ~AVR_ASSR_BUSY;	// The busy bits are read only
+			return;
+		case AVR_TCNT2:									// TCN2UB
+		case AVR_OCR2:									// OCR2UB
+		case AVR_TCCR2:									// TCR2UB
+			if (avr->data[AVR_ASSR] & (1 << AVR_ASSR_AS2))
+				avr_timer2_busy(avr, (address == AVR_TCNT2)?0x04:(address == AVR_OCR2)?0x02:0x01);
+			break;
+	}
+	avr->data[address] = value;
+}
+
+static void avr_push(avr_t *avr, uint8_t value) {
+	uint16_t sp = avr_sp(avr);
+
+	avr_write(avr, sp, value);
+	avr_set_sp(avr, sp - 1);
+}
+
+static uint8_t avr_pop(avr_t *avr) {
+	uint16_t sp = avr_sp(avr) + 1;
+
+	avr_set_sp(avr, sp);
+	return avr_read(avr, sp);
+}
+
+static void avr_push_pc(avr_t *avr, uint16_t pc) {
+	avr_push(avr, pc);
+	avr_push(avr, pc >> 8);
+}
+
+static uint16_t avr_pop_pc(avr_t *avr) {
+	uint16_t pc = avr_pop(avr) << 8;
+
+	return pc | avr_pop(avr);
+}
+
+static uint8_t avr_add(avr_t *avr, uint8_t d, uint8_t r, uint8_t carry) {
+	uint8_t result = d + r + carry;
+
+	avr_flag(avr, AVR_SREG_H, ((d & r) | (r & ~result) | (~result & d)) & 0x08);
+	avr_flag(avr, AVR_SREG_V, ((d & r & ~result) | (~d & ~r & result)) & 0x80);
+	avr_flag(avr, AVR_SREG_C, ((d & r) | (r & ~result) | (~result & d)) & 0x80);
+	avr_nzs(avr, result);
+	return result;
+}
+
+static uint8_t avr_sub(avr_t *avr, uint8_t d, uint8_t r, uint8_t carry, uint8_t keep_z) {
+	// SBC, SBCI and CPC only clear Z, so a multi byte compare is zero when all of it is
+	uint8_t result = d - r - carry;
+	uint8_t z = FLAG(AVR_SREG_Z);
+
+	avr_flag(avr, AVR_SREG_H, ((~d & r) | (r & result) | (result & ~d)) & 0x08);
+	avr_flag(avr, AVR_SREG_V, ((d & ~r & ~result) | (~d & r & result)) & 0x80);
+	avr_flag(avr, AVR_SREG_C, ((~d & r) | (r & result) | (result & ~d)) & 0x80);
+	avr_nzs(avr, result);
+	if (keep_z)
+		avr_flag(avr, AVR_SREG_Z, (result == 0) && z);
+	return result;
+}
+
+static uint8_t avr_logic(avr_t *avr, uint8_t result) {
+	avr_flag(avr, AVR_SREG_V, 0);
+	avr_nzs(avr, result);
+	return result;
+}
+
+static void avr_multiply(avr_t *avr, int32_t product, uint8_t shift) {
+	// Product into r1:r0, C is bit 15 before any fractional shift
+	uint16_t result = product << shift;
+
+	avr_flag(avr, AVR_SREG_C, BIT(product, 15));
+	avr_flag(avr, AVR_SREG_Z, result == 0);
+	R(0) = result;
+	R(1) = result >> 8;
+	avr->cycles += 2;
+}
+
+static uint8_t avr_two_words(uint16_t op) {
+	// lds, sts, jmp and call, a skip over one of these takes an extra cycle
+	return ((op & 0xFC0F) == 0x9000) || ((op & 0xFE0C) == 0x940C);
+}
+
+static void avr_skip(avr_t *avr, uint8_t skip) {
+	if (!skip) {
+		avr->cycles += 1;
+		return;
+	}
+	if (avr_two_words(avr->flash[avr->pc & (AVR_FLASH_WORDS - 1)])) {
+		avr->pc += 2;
+		avr->cycles += 3;
+	} else {
+		avr->pc += 1;
+		avr->cycles += 2;
+	}
+}
+
+static uint16_t avr_pointer(avr_t *avr, uint8_t low) {
+	return R(low) | (R(low + 1) << 8);
+}
+
+static void avr_set_pointer(avr_t *avr, uint8_t low, uint16_t value) {
+	R(low) = value;
+	R(low + 1) = value >> 8;
+}
+
+static uint8_t avr_indirect(avr_t *avr, uint16_t op, uint8_t store) {
+	// ld and st through X, Y or Z with post increment or pre decrement, 2 cycles
+	uint8_t d = (op >> 4) & 0x1F, low;
+	uint16_t address;
+
+	switch (op & 0x000F) {
+		case 0x1: case 0x2: low = 30; break;
+		case 0x9: case 0xA: low = 28; break;
+		case 0xC: case 0xD: case 0xE: low = 26; break;
+		default: return 0;
+	}
+	address = avr_pointer(avr, low);
+	if ((op & 0x3) == 0x2)
+		address--;
+	if (store)
+		avr_write(avr, address, R(d));
+	else
+		R(d) = avr_read(avr, address);
+	if ((op & 0x3) == 0x1)
+		address++;
+	if (op & 0x3)
+		avr_set_pointer(avr, low, address);
+	avr->cycles += 2;
+	return 1;
+}
+
+void avr_reset(avr_t *avr) {
+	memset(avr->data, 0, sizeof(avr->data));
+	avr->pc = 0;
+	avr->cycles = 0;
+	avr->eemwe_until = 0;
+	memset(avr->assr_until, 0, sizeof(avr->assr_until));
+	avr->fault = NULL;
+}
+
+void avr_interrupt(avr_t *avr, uint8_t vector) {
+	// Take an interrupt, 4 cycles to push the PC and clear I
+	avr_push_pc(avr, avr->pc);
+	SREG &= ~(1 << AVR_SREG_I);
+	avr->pc = vector * AVR_VECTOR_WORDS;
+	avr->cycles += 4;
+}
+
+void avr_call(avr_t *avr, uint16_t address) {
+	// Call a function as if from wherever the PC is, the cycles start with its first instruction
+	avr_push_pc(avr, avr->pc);
+	avr->pc = address;
+}
+
+uint8_t avr_step(avr_t *avr) {
+	uint16_t op, k, word;
+	uint8_t d, r, a, b, value, result;
+	uint8_t status = AVR_OK;
+
+	if (avr->pc >= AVR_FLASH_WORDS) {
+		avr->fault = "PC outside flash";
+		return AVR_BAD;
+	}
+	op = avr->flash[avr->pc++];
+	d = (op >> 4) & 0x1F;
+	r = (op & 0x0F) | ((op >> 5) & 0x10);
+	k = ((op >> 4) & 0xF0) | (op & 0x0F);			// 8 bit immediate
+	a = (op & 0x0F) | ((op >> 5) & 0x30);			// in and out address
+
+	switch (op >> 12) {
+		case 0x0:
+			switch ((op >> 10) & 0x3) {
+				case 0:
+					switch ((op >> 8) & 0x3) {
+						case 0:								// nop
+							if (op != 0x0000)
+								goto bad;
+							avr->cycles += 1;
+							break;
+						case 1:								// movw
+							R(((op >> 4) & 0xF) * 2) = R((op & 0xF) * 2);
+							R(((op >> 4) & 0xF) * 2 + 1) = R((op & 0xF) * 2 + 1);
+							avr->cycles += 1;
+							break;
+						case 2:								// muls
+							avr_multiply(avr, (int8_t)R(16 + ((op >> 4) & 0xF)) * (int8_t)R(16 + (op & 0xF)), 0);
+							break;
+						case 3:								// mulsu, fmul, fmuls, fmulsu
+							d = 16 + ((op >> 4) & 0x7);
+							r = 16 + (op & 0x7);
+							switch (op & 0x88) {
+								case 0x00: avr_multiply(avr, (int8_t)R(d) * R(r), 0); break;
+								case 0x08: avr_multiply(avr, R(d) * R(r), 1); break;
+								case 0x80: avr_multiply(avr, (int8_t)R(d) * (int8_t)R(r), 1); break;
+								case 0x88: avr_multiply(avr, (int8_t)R(d) * R(r), 1); break;
+							}
+							break;
+					}
+					break;
+				case 1:										// cpc
+					avr_sub(avr, R(d), R(r), FLAG(AVR_SREG_C), 1);
+					avr->cycles += 1;
+					break;
+				case 2:										// sbc
+					R(d) = avr_sub(avr, R(d), R(r), FLAG(AVR_SREG_C), 1);
+					avr->cycles += 1;
+					break;
+				case 3:										// add
+					R(d) = avr_add(avr, R(d), R(r), 0);
+					avr->cycles += 1;
+					break;
+			}
+			break;
+		case 0x1:
+			switch ((op >> 10) & 0x3) {
+				case 0:										// cpse
+					avr_skip(avr, R(d) == R(r));
+					break;
+				case 1:										// cp
+					avr_sub(avr, R(d), R(r), 0, 0);
+					avr->cycles += 1;
+					break;
+				case 2:										// sub
+					R(d) = avr_sub(avr, R(d), R(r), 0, 0);
+					avr->cycles += 1;
+					break;
+				case 3:										// adc
+					R(d) = avr_add(avr, R(d), R(r), FLAG(AVR_SREG_C));
+					avr->cycles += 1;
+					break;
+			}
+			break;
+		case 0x2:
+			switch ((op >> 10) & 0x3) {
+				case 0: R(d) = avr_logic(avr, R(d) & R(r)); break;		// and
+				case 1: R(d) = avr_logic(avr, R(d) ^ R(r)); break;		// eor
+				case 2: R(d) = avr_logic(avr, R(d) | R(r)); break;		// or
+				case 3: R(d) = R(r); break;								// mov
+			}
+			avr->cycles += 1;
+			break;
+		case 0x3:											// cpi
+			avr_sub(avr, R(16 + (d & 0xF)), k, 0, 0);
+			avr->cycles += 1;
+			break;
+		case 0x4:											// sbci
+			R(16 + (d & 0xF)) = avr_sub(avr, R(16 + (d & 0xF)), k, FLAG(AVR_SREG_C), 1);
+			avr->cycles += 1;
+			break;
+		case 0x5:											// subi
+			R(16 + (d & 0xF)) = avr_sub(avr, R(16 + (d & 0xF)), k, 0, 0);
+			avr->cycles += 1;
+			break;
+		case 0x6:											// ori
+			R(16 + (d & 0xF)) = avr_logic(avr, R(16 + (d & 0xF)) | k);
+			avr->cycles += 1;
+			break;
+		case 0x7:											// andi
+			R(16 + (d & 0xF)) = avr_logic(avr, R(16 + (d & 0xF)) & k);
+			avr->cycles += 1;
+			break;
+		case 0x8:
+		case 0xA: {											// ldd and std through Y or Z
+			uint16_t address = avr_pointer(avr, (op & 0x0008)?28:30);
+
+			address += (op & 0x7) | ((op >> 7) & 0x18) | ((op >> 8) & 0x20);
+			if (op & 0x0200)
+				avr_write(avr, address, R(d));
+			else
+				R(d) = avr_read(avr, address);
+			avr->cycles += 2;
+			break;
+		}
+		case 0x9:
+			switch ((op >> 8) & 0xF) {
+				case 0x0:
+				case 0x1:									// loads
+					switch (op & 0xF) {
+						case 0x0:							// lds
+							R(d) = avr_read(avr, avr->flash[avr->pc++ & (AVR_FLASH_WORDS - 1)]);
+							avr->cycles += 2;
+							break;
+						case 0x4:							// lpm Rd, Z
+						case 0x5:							// lpm Rd, Z+
+							word = avr_pointer(avr, 30);
+							R(d) = avr->flash[(word >> 1) & (AVR_FLASH_WORDS - 1)] >> ((word & 1) * 8);
+							if (op & 0x1)
+								avr_set_pointer(avr, 30, word + 1);
+							avr->cycles += 3;
+							break;
+						case 0xF:							// pop
+							R(d) = avr_pop(avr);
+							avr->cycles += 2;
+							break;
+						default:
+							if (!avr_indirect(avr, op, 0))
+								goto bad;
+							break;
+					}
+					break;
+				case 0x2:
+				case 0x3:									// stores
+					switch (op & 0xF) {
+						case 0x0:							// sts
+							avr_write(avr, avr->flash[avr->pc++ & (AVR_FLASH_WORDS - 1)], R(d));
+							avr->cycles += 2;
+							break;
+						case 0xF:							// push
+							avr_push(avr, R(d));
+							avr->cycles += 2;
+							break;
+						default:
+							if (!avr_indirect(avr, op, 1))
+								goto bad;
+							break;
+					}
+					break;
+				case 0x4:
+				case 0x5:									// one operand and the odd ones out
+					switch (op & 0xF) {
+						case 0x0:							// com
+							R(d) = ~R(d);
+							avr_flag(avr, AVR_SREG_C, 1);
+							avr_logic(avr, R(d));
+							avr->cycles += 1;
+							break;
+						case 0x1:							// neg
+							value = R(d);
+							result = R(d) = -value;
+							avr_flag(avr, AVR_SREG_H, BIT(result | value, 3));
+							avr_flag(avr, AVR_SREG_V, result == 0x80);
+							avr_flag(avr, AVR_SREG_C, result != 0);
+							avr_nzs(avr, result);
+							avr->cycles += 1;
+							break;
+						case 0x2:							// swap
+							R(d) = (R(d) << 4) | (R(d) >> 4);
+							avr->cycles += 1;
+							break;
+						case 0x3:							// inc
+							result = ++R(d);
+							avr_flag(avr, AVR_SREG_V, result == 0x80);
+							avr_nzs(avr, result);
+							avr->cycles += 1;
+							break;
+						case 0x5:							// asr
+						case 0x6:							// lsr
+						case 0x7:							// ror
+							value = R(d);
+							result = value >> 1;
+							if ((op & 0xF) == 0x5)
+								result |= value & 0x80;
+							else if ((op & 0xF) == 0x7)
+								result |= FLAG(AVR_SREG_C) << 7;
+							R(d) = result;
+							avr_flag(avr, AVR_SREG_C, value & 1);
+							avr_flag(avr, AVR_SREG_N, BIT(result, 7));
+							avr_flag(avr, AVR_SREG_V, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_C));
+							avr_flag(avr, AVR_SREG_Z, result == 0);
+							avr_flag(avr, AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+							avr->cycles += 1;
+							break;
+						case 0x8:
+							if ((op & 0xFF0F) == 0x9408) {	// bset and bclr, sei cli and the rest
+								avr_flag(avr, (op >> 4) & 0x7, !(op & 0x0080));
+								avr->cycles += 1;
+								break;
+							}
+							switch (op) {
+								case 0x9508:				// ret
+								case 0x9518:				// reti
+									avr->pc = avr_pop_pc(avr);
+									if (op == 0x9518)
+										SREG |= (1 << AVR_SREG_I);
+									avr->cycles += 4;
+									status = AVR_RETURN;
+									break;
+								case 0x9588:				// sleep
+									avr->cycles += 1;
+									status = AVR_SLEEP;
+									break;
+								case 0x9598:				// break
+								case 0x95A8:				// wdr
+									avr->cycles += 1;
+									break;
+								case 0x95C8:				// lpm, into r0
+									word = avr_pointer(avr, 30);
+									R(0) = avr->flash[(word >> 1) & (AVR_FLASH_WORDS - 1)] >> ((word & 1) * 8);
+									avr->cycles += 3;
+									break;
+								default:
+									goto bad;
+							}
+							break;
+						case 0x9:
+							if (op == 0x9409) {				// ijmp
+								avr->pc = avr_pointer(avr, 30);
+								avr->cycles += 2;
+							} else if (op == 0x9509) {		// icall
+								avr_push_pc(avr, avr->pc);
+								avr->pc = avr_pointer(avr, 30);
+								avr->cycles += 3;
+							} else {
+								goto bad;
+							}
+							break;
+						case 0xA:							// dec
+							result = --R(d);
+							avr_flag(avr, AVR_SREG_V, result == 0x7F);
+							avr_nzs(avr, result);
+							avr->cycles += 1;
+							break;
+						case 0xC:
+						case 0xD:							// jmp
+						case 0xE:
+						case 0xF:							// call
+							word = avr->flash[avr->pc++ & (AVR_FLASH_WORDS - 1)];
+							if (op & 0x0002) {
+								avr_push_pc(avr, avr->pc);
+								avr->cycles += 4;
+							} else {
+								avr->cycles += 3;
+							}
+							avr->pc = word;
+							break;
+						default:
+							goto bad;
+					}
+					break;
+				case 0x6:									// adiw
+				case 0x7: {									// sbiw
+					uint8_t low = 24 + ((op >> 3) & 0x6);
+					uint16_t before = avr_pointer(avr, low);
+					uint16_t after;
+					uint8_t immediate = (op & 0xF) | ((op >> 2) & 0x30);
+
+					if (op & 0x0100) {
+						after = before - immediate;
+						avr_flag(avr, AVR_SREG_V, BIT(before, 15) && (!BIT(after, 15)));
+						avr_flag(avr, AVR_SREG_C, BIT(after, 15) && (!BIT(before, 15)));
+					} else {
+						after = before + immediate;
+						avr_flag(avr, AVR_SREG_V, (!BIT(before, 15)) && BIT(after, 15));
+						avr_flag(avr, AVR_SREG_C, (!BIT(after, 15)) && BIT(before, 15));
+					}
+					avr_set_pointer(avr, low, after);
+					avr_flag(avr, AVR_SREG_N, BIT(after, 15));
+					avr_flag(avr, AVR_SREG_Z, after == 0);
+					avr_flag(avr, AVR_SREG_S, FLAG(AVR_SREG_N) ^ FLAG(AVR_SREG_V));
+					avr->cycles += 2;
+					break;
+				}
+				case 0x8:									// cbi
+				case 0xA:									// sbi
+					a = 0x20 + ((op >> 3) & 0x1F);
+					b = op & 0x7;
+					if (op & 0x0200)
+						avr_write(avr, a, avr->data[a] | (1 << b));
+					else
+						avr_write(avr, a, avr->data[a] & ~(1 << b));
+					avr->cycles += 2;
+					break;
+				case 0x9:									// sbic
+				case 0xB:									// sbis
+					a = 0x20 + ((op >> 3) & 0x1F);
+					b = op & 0x7;
+					avr_skip(avr, BIT(avr_read(avr, a), b) == ((op >> 9) & 1));
+					break;
+				default:									// mul
+					avr_multiply(avr, R(d) * R(r), 0);
+					break;
+			}
+			break;
+		case 0xB:
+			if (op & 0x0800)								// out
+				avr_write(avr, 0x20 + a, R(d));
+			else											// in
+				R(d) = avr_read(avr, 0x20 + a);
+			avr->cycles += 1;
+			break;
+		case 0xC:											// rjmp
+		case 0xD:											// rcall
+			if (op & 0x1000) {
+				avr_push_pc(avr, avr->pc);
+				avr->cycles += 3;
+			} else {
+				avr->cycles += 2;
+			}
+			avr->pc += ((int16_t)(op << 4)) >> 4;
+			break;
+		case 0xE:											// ldi
+			R(16 + (d & 0xF)) = k;
+			avr->cycles += 1;
+			break;
+		case 0xF:
+			b = op & 0x7;
+			switch ((op >> 9) & 0x7) {
+				case 0:
+				case 1:
+				case 2:
+				case 3:										// brbs and brbc
+					if (FLAG(b) == !(op & 0x0400)) {
+						avr->pc += ((int8_t)(op >> 2)) >> 1;
+						avr->cycles += 2;
+					} else {
+						avr->cycles += 1;
+					}
+					break;
+				case 4:										// bld
+					R(d) = (R(d) & ~(1 << b)) | (FLAG(AVR_SREG_T) << b);
+					avr->cycles += 1;
+					break;
+				case 5:										// bst
+					avr_flag(avr, AVR_SREG_T, BIT(R(d), b));
+					avr->cycles += 1;
+					break;
+				case 6:										// sbrc
+				case 7:										// sbrs
+					avr_skip(avr, BIT(R(d), b) == ((op >> 9) & 1));
+					break;
+			}
+			break;
+	}
+	if (avr->fault)
+		return AVR_BAD;
+	return status;
+
+bad:
+	avr->pc--;
+	avr->fault = "unknown instruction";
+	return AVR_BAD;
+}
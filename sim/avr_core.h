@@ -0,0 +1,91 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Small ATmega16 instruction set simulator for make cycles, see cycles.c
+// Cycle counts are the ones in the instruction set manual for a part with a 16 bit PC, the I/O
+// registers are plain memory apart from the interrupt flags, the EEPROM, which finishes at once,
+// and the Timer2 update busy bits in ASSR. The timers themselves don't count
+
+#ifndef __AVR_CORE_H_
+#define __AVR_CORE_H_
+
+#include <stdint.h>
+
+#define AVR_FLASH_WORDS		8192					// 16K
+#define AVR_DATA_SIZE		0x460					// Registers, I/O and 1K of SRAM
+#define AVR_EEPROM_SIZE		512
+#define AVR_VECTORS			21						// Including reset
+#define AVR_VECTOR_WORDS	2						// Each one is a jmp
+
+// Data space addresses of the registers the core uses itself
+#define AVR_EECR			0x3C
+#define AVR_EEDR			0x3D
+#define AVR_EEARL			0x3E
+#define AVR_EEARH			0x3F
+#define AVR_ASSR			0x42
+#define AVR_OCR2			0x43
+#define AVR_TCNT2			0x44
+#define AVR_TCCR2			0x45
+#define AVR_TIFR			0x58
+#define AVR_GIFR			0x5A
+#define AVR_SPL				0x5D
+#define AVR_SPH				0x5E
+#define AVR_SREG			0x5F
+
+#define AVR_SREG_C			0
+#define AVR_SREG_Z			1
+#define AVR_SREG_N			2
+#define AVR_SREG_V			3
+#define AVR_SREG_S			4
+#define AVR_SREG_H			5
+#define AVR_SREG_T			6
+#define AVR_SREG_I			7
+
+// Asynchronous Timer2, a write to TCCR2, OCR2 or TCNT2 holds its busy bit in ASSR until it gets across
+// to the 32kHz side, up to two TOSC1 edges later. 8MHz / 32768Hz cycles an edge
+#define AVR_ASSR_AS2		3
+#define AVR_ASSR_BUSY		0x07					// TCN2UB, OCR2UB and TCR2UB
+#define AVR_TOSC_CYCLES		244
+#define AVR_TOSC_UPDATE		(2 * AVR_TOSC_CYCLES)
+
+// What avr_step() ran into
+#define AVR_OK				0
+#define AVR_RETURN			1						// ret or reti
+#define AVR_SLEEP			2
+#define AVR_BAD				3						// Unknown opcode or out of range access
+
+typedef struct _avr_t {
+	uint16_t	flash[AVR_FLASH_WORDS];
+	uint8_t		data[AVR_DATA_SIZE];
+	uint8_t		eeprom[AVR_EEPROM_SIZE];
+	uint16_t	pc;									// In words
+	uint64_t	cycles;
+	uint64_t	eemwe_until;						// EEMWE clears itself four cycles after it was set
+	uint64_t	assr_until[3];						// Each ASSR busy bit reads as set until then
+	const char	*fault;								// Why the last AVR_BAD
+} avr_t;
+
+void avr_reset(avr_t *avr);
+uint8_t avr_step(avr_t *avr);
+void avr_interrupt(avr_t *avr, uint8_t vector);
+void avr_call(avr_t *avr, uint16_t address);
+uint16_t avr_sp(const avr_t *avr);
+void avr_timer2_busy(avr_t *avr, uint8_t bits);
+
+#endif // __AVR_CORE_H_
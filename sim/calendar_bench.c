@@ -0,0 +1,271 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Calendar and daylight saving time regression for the RTC, built and run with make bench
+// Every second from 1/1/2000 on goes through the Timer2 overflow ISR, rtc_sync() and dst_task() the same
+// as the main loop does it, then clock is checked against a calendar worked out here a different way,
+// from days since 1/1/1970. It runs until the 32 bit rtc_seconds is about to run out early in 2136.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+#define main firmware_main				// nixie.h declares the firmware's main(), renamed by the Makefile
+#include "../include/nixie.h"
+#undef main
+#include "../include/rtc.h"
+#include "../include/dst.h"
+#include "../include/calendar.h"
+
+#define BENCH_YEARS		136				// 2000 through 2135
+#define BENCH_ERRORS	10				// Give up after this many
+
+// Daylight saving time rules, in the same terms as the settings
+typedef struct _bench_rule_t {
+	const char	*name;
+	uint8_t		spring_hour, spring_day, spring_week, spring_month;
+	uint8_t		fall_hour, fall_day, fall_week, fall_month;
+} bench_rule_t;
+
+static const bench_rule_t bench_rules[] = {
+	{ "us",	2, 0, 2, 3,		2, 0, 1, 11 },		// Second Sunday in March to the first in November, the default
+	{ "eu",	2, 0, 5, 3,		3, 0, 5, 10 },		// Last Sunday in March to the last in October
+	{ "au",	2, 0, 1, 10,	3, 0, 1, 4 },		// First Sunday in October to the first in April, spans the new year
+};
+#define BENCH_RULES		(sizeof(bench_rules) / sizeof(bench_rules[0]))
+
+// Transitions the reference expects, in local seconds since 1/1/2000
+typedef struct _bench_transition_t {
+	int64_t		when;
+	int32_t		offset;					// Added to the local time
+} bench_transition_t;
+
+static bench_transition_t bench_transitions[BENCH_YEARS * 2 + 1];
+static uint32_t bench_errors = 0;
+
+static int64_t civil_days(int64_t year, uint8_t month, uint8_t date) {
+	// Days since 1/1/1970, from http://howardhinnant.github.io/date_algorithms.html
+	int64_t era, yoe, doy;
+
+	year -= (month <= 2);
+	era = ((year >= 0)?year:year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month + ((month > 2)?-3:9)) + 2) / 5 + date - 1;
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static void civil_date(int64_t days, int64_t *year, uint8_t *month, uint8_t *date) {
+	// The other way
+	int64_t era, doe, yoe, doy, mp;
+
+	days += 719468;
+	era = ((days >= 0)?days:days - 146096) / 146097;
+	doe = days - era * 146097;
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+	*date = doy - (153 * mp + 2) / 5 + 1;
+	*month = (mp < 10)?mp + 3:mp - 9;
+	*year = yoe + era * 400 + (*month <= 2);
+}
+
+static uint8_t civil_weekday(int64_t days) {
+	// 1/1/1970 was a Thursday, 0 is Sunday
+	return (days >= -4)?(days + 4) % 7:(days + 5) % 7 + 6;
+}
+
+static int64_t bench_instant(int64_t year, uint8_t month, uint8_t day, uint8_t week, uint8_t hour) {
+	// Local seconds since 1/1/2000 of the hour on the nth day of the week, or the last one for week 5
+	// Counts back from the end of the month for the last one, not forward like dst.c
+	int64_t days;
+
+	if (week == DST_LAST_WEEK) {
+		days = civil_days(year + (month == 12), (month % 12) + 1, 1) - 1;
+		days -= (civil_weekday(days) + 7 - day) % 7;
+	} else {
+		days = civil_days(year, month, 1);
+		days += (day + 7 - civil_weekday(days)) % 7 + (week - 1) * 7;
+	}
+	return (days - civil_days(CALENDAR_EPOCH_YEAR, 1, 1)) * 86400 + hour * 3600;
+}
+
+static void bench_reference(const bench_rule_t *rule) {
+	// Every transition through the years run, in order
+	uint32_t count = 0;
+	int64_t year, spring, fall;
+	bench_transition_t swap;
+
+	for (year = CALENDAR_EPOCH_YEAR; year < CALENDAR_EPOCH_YEAR + BENCH_YEARS; year++) {
+		spring = bench_instant(year, rule->spring_month, rule->spring_day, rule->spring_week, rule->spring_hour);
+		fall = bench_instant(year, rule->fall_month, rule->fall_day, rule->fall_week, rule->fall_hour);
+		bench_transitions[count++] = (bench_transition_t){ spring, 3600 };
+		bench_transitions[count++] = (bench_transition_t){ fall, -3600 };
+		if (fall < spring) {
+			swap = bench_transitions[count - 1];
+			bench_transitions[count - 1] = bench_transitions[count - 2];
+			bench_transitions[count - 2] = swap;
+		}
+	}
+	bench_transitions[count] = (bench_transition_t){ INT64_MAX, 0 };
+}
+
+static void bench_error(int64_t local, const char *what) {
+	// Say what clock should have shown
+	int64_t year;
+	uint8_t month, date;
+
+	civil_date(civil_days(CALENDAR_EPOCH_YEAR, 1, 1) + local / 86400, &year, &month, &date);
+	printf("%s: expected %04lld-%02u-%02u %02u:%02u:%02u day %u, clock %04u-%02u-%02u %02u:%02u:%02u day %u, rtc_seconds %lu\n",
+		what, (long long)year, month, date, (uint8_t)(local % 86400 / 3600), (uint8_t)(local % 3600 / 60),
+		(uint8_t)(local % 60), civil_weekday(civil_days(CALENDAR_EPOCH_YEAR, 1, 1) + local / 86400),
+		clock.year + CALENDAR_EPOCH_YEAR, clock.month, clock.date, clock.hour, clock.minute, clock.second,
+		clock.day, (unsigned long)rtc_seconds);
+	if (++bench_errors >= BENCH_ERRORS) {
+		printf("too many errors\n");
+		exit(1);
+	}
+}
+
+static void bench_usage(void) {
+	fprintf(stderr,
+		"usage: calendar-bench [-r us|eu|au|none] [-y years] [-q]\n"
+		"  -r  daylight saving time rule (default us)\n"
+		"  -y  years to run from 1/1/2000 (default and most %d)\n"
+		"  -q  take the 1/4 second compare interrupts as well\n", BENCH_YEARS);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	const bench_rule_t *rule = &bench_rules[0];
+	uint32_t years = BENCH_YEARS, next = 0;
+	uint64_t isrs = 0;
+	uint8_t quarters = FALSE, month, date, event;
+	int64_t local = 0, end, today = -1, epoch, year;
+	int32_t time_of_day = 0;
+	uint8_t weekday = 0;
+	uint32_t second, i;
+	struct timeval started, finished;
+	double wall;
+
+	for (i = 1; i < (uint32_t)argc; i++) {
+		if ((!strcmp(argv[i], "-r")) && (i + 1 < (uint32_t)argc)) {
+			i++;
+			if (!strcmp(argv[i], "none")) {
+				rule = NULL;
+			} else {
+				for (rule = bench_rules; rule < &bench_rules[BENCH_RULES]; rule++)
+					if (!strcmp(argv[i], rule->name))
+						break;
+				if (rule == &bench_rules[BENCH_RULES])
+					bench_usage();
+			}
+		} else if ((!strcmp(argv[i], "-y")) && (i + 1 < (uint32_t)argc)) {
+			years = atoi(argv[++i]);
+			if ((years < 1) || (years > BENCH_YEARS))
+				bench_usage();
+		} else if (!strcmp(argv[i], "-q")) {
+			quarters = TRUE;
+		} else {
+			bench_usage();
+		}
+	}
+
+	// The reference
+	epoch = civil_days(CALENDAR_EPOCH_YEAR, 1, 1);
+	end = (civil_days(CALENDAR_EPOCH_YEAR + years, 1, 1) - epoch) * 86400;
+	if (rule)
+		bench_reference(rule);
+	else
+		bench_transitions[0].when = INT64_MAX;
+
+	// The firmware, started at midnight 1/1/2000 with no time correction
+	sim_reset();
+	init_rtc();
+	clock.year = 0;
+	clock.month = 1;
+	clock.date = 1;
+	clock.hour = 0;
+	clock.minute = 0;
+	clock.second = 0;
+	rtc_set_clock();
+	rtc_set_correction(0);
+	clock_settings.daylight_saving_enable = (rule != NULL);
+	if (rule) {
+		clock_settings.spring_ahead_hour = rule->spring_hour;
+		clock_settings.spring_ahead_day = rule->spring_day;
+		clock_settings.spring_ahead_week = rule->spring_week;
+		clock_settings.spring_ahead_month = rule->spring_month;
+		clock_settings.fall_back_hour = rule->fall_hour;
+		clock_settings.fall_back_day = rule->fall_day;
+		clock_settings.fall_back_week = rule->fall_week;
+		clock_settings.fall_back_month = rule->fall_month;
+	}
+	dst_schedule(rtc_now());
+
+	gettimeofday(&started, NULL);
+	for (second = 0; local < end; second++) {
+		// The second ticks over, then the 1/4, 1/2 and 3/4 compares, DST is looked at on the 1/2
+		TIMER2_OVF_vect();
+		isrs++;
+		if (quarters) {
+			TIMER2_COMP_vect();
+			TIMER2_COMP_vect();
+			TIMER2_COMP_vect();
+			isrs += 3;
+		}
+		while ((event = rtc_event_pop()) != CLEAR) {
+			rtc_sync();
+			if ((event == HALF_SECOND) || (!quarters))
+				dst_task();
+		}
+
+		local++;
+		if (++time_of_day == 86400)
+			time_of_day = 0;
+		if (local == bench_transitions[next].when) {
+			local += bench_transitions[next++].offset;
+			time_of_day = local % 86400;
+		}
+
+		// Check the time every second and the date every day
+		if ((rtc_seconds != local) || (clock.hour * 3600L + clock.minute * 60 + clock.second != time_of_day))
+			bench_error(local, "time");
+		if (local / 86400 != today) {
+			today = local / 86400;
+			civil_date(epoch + today, &year, &month, &date);
+			weekday = civil_weekday(epoch + today);
+		}
+		if ((clock.date != date) || (clock.month != month) || (clock.day != weekday)
+			|| (clock.year + CALENDAR_EPOCH_YEAR != year))
+			bench_error(local, "date");
+	}
+	gettimeofday(&finished, NULL);
+	wall = (finished.tv_sec - started.tv_sec) + (finished.tv_usec - started.tv_usec) / 1e6;
+
+	printf("%u years, %u seconds, %u DST transitions (%s), %u errors\n", years, second,
+		next, (rule)?rule->name:"none", bench_errors);
+	printf("%llu RTC interrupts in %.2f seconds, %.0f simulated seconds per second\n", (unsigned long long)isrs, wall,
+		(wall > 0)?second / wall:0);
+	return (bench_errors)?1:0;
+}
@@ -0,0 +1,378 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// ISR and main loop cycle counts from the real firmware, built and run with make cycles
+// Loads the ELF into the core in avr_core.c, runs the startup code and main() up to its first
+// sleep so everything is initialized, then from a copy of that state calls every interrupt and
+// function listed in the budget file and counts the cycles until it returns. An interrupt counts
+// from the 4 cycle response through the reti, a function from its first instruction through the ret.
+// Fails if any of them go over budget, don't return or have a budget of - that was never filled in.
+// -u writes what it measured back into the budget file with CYCLES_HEADROOM added, run it on an
+// avr-gcc build and check the numbers in with the change that moved them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <elf.h>
+
+#include "avr_core.h"
+
+#define CYCLES_F_CPU		8000000UL
+#define CYCLES_STARTUP		(CYCLES_F_CPU * 10)		// Give up on main() reaching a sleep after 10 seconds
+#define CYCLES_LIMIT		(CYCLES_F_CPU / 10)		// An interrupt or task taking 100ms isn't coming back
+#define CYCLES_SETTINGS		8
+#define CYCLES_HEADROOM(c)	((c) + ((c) + 7) / 8)	// -u budgets are an eighth over what was measured
+#define CYCLES_NO_BUDGET	0xFFFFFFFF
+
+// ELF addresses above these are SRAM and EEPROM
+#define ELF_DATA			0x800000
+#define ELF_EEPROM			0x810000
+
+typedef struct _cycles_name_t {
+	const char	*name;
+	uint16_t	address;
+	uint8_t		size;
+} cycles_name_t;
+
+// I/O registers by data space address, and r0-r31 are handled on their own
+static const cycles_name_t io_names[] = {
+	{ "PIND", 0x30, 1 }, { "DDRD", 0x31, 1 }, { "PORTD", 0x32, 1 }, { "PINC", 0x33, 1 },
+	{ "DDRC", 0x34, 1 }, { "PORTC", 0x35, 1 }, { "PINB", 0x36, 1 }, { "DDRB", 0x37, 1 },
+	{ "PORTB", 0x38, 1 }, { "PINA", 0x39, 1 }, { "DDRA", 0x3A, 1 }, { "PORTA", 0x3B, 1 },
+	{ "EECR", 0x3C, 1 }, { "EEDR", 0x3D, 1 }, { "EEAR", 0x3E, 2 }, { "WDTCR", 0x41, 1 },
+	{ "ASSR", 0x42, 1 }, { "OCR2", 0x43, 1 }, { "TCNT2", 0x44, 1 }, { "TCCR2", 0x45, 1 },
+	{ "ICR1", 0x46, 2 }, { "OCR1B", 0x48, 2 }, { "OCR1A", 0x4A, 2 }, { "TCNT1", 0x4C, 2 },
+	{ "TCCR1B", 0x4E, 1 }, { "TCCR1A", 0x4F, 1 }, { "TCNT0", 0x52, 1 }, { "TCCR0", 0x53, 1 },
+	{ "MCUCSR", 0x54, 1 }, { "MCUCR", 0x55, 1 }, { "TIFR", 0x58, 1 }, { "TIMSK", 0x59, 1 },
+	{ "GIFR", 0x5A, 1 }, { "GICR", 0x5B, 1 }, { "OCR0", 0x5C, 1 }, { "SREG", 0x5F, 1 },
+};
+#define IO_NAMES		(sizeof(io_names) / sizeof(io_names[0]))
+
+// ATmega16 interrupt vectors in table order, reset is 0
+static const char *vector_names[AVR_VECTORS] = {
+	"RESET", "INT0_vect", "INT1_vect", "TIMER2_COMP_vect", "TIMER2_OVF_vect", "TIMER1_CAPT_vect",
+	"TIMER1_COMPA_vect", "TIMER1_COMPB_vect", "TIMER1_OVF_vect", "TIMER0_OVF_vect", "SPI_STC_vect",
+	"USART_RXC_vect", "USART_UDRE_vect", "USART_TXC_vect", "ADC_vect", "EE_RDY_vect",
+	"ANA_COMP_vect", "TWI_vect", "INT2_vect", "TIMER0_COMP_vect", "SPM_RDY_vect",
+};
+
+static avr_t avr, booted;
+static uint8_t *elf;
+static const Elf32_Sym *symbols;
+static uint32_t symbol_count;
+static const char *symbol_names;
+static uint8_t vector_listed[AVR_VECTORS];
+
+static void load(const char *file) {
+	// Flash from the loadable segments at their load addresses, .data included for the startup
+	// code to copy, EEPROM from .eeprom, and the symbol table for the names
+	FILE *f = fopen(file, "rb");
+	const Elf32_Ehdr *header;
+	const Elf32_Phdr *segment;
+	const Elf32_Shdr *section;
+	long length;
+	uint32_t i, address;
+
+	if (!f) {
+		perror(file);
+		exit(2);
+	}
+	fseek(f, 0, SEEK_END);
+	length = ftell(f);
+	rewind(f);
+	elf = malloc(length);
+	if ((!elf) || (fread(elf, 1, length, f) != (size_t)length)) {
+		fprintf(stderr, "%s: can't read it\n", file);
+		exit(2);
+	}
+	fclose(f);
+
+	header = (const Elf32_Ehdr *)elf;
+	if ((length < (long)sizeof(*header)) || (memcmp(header->e_ident, ELFMAG, SELFMAG)) ||
+		(header->e_ident[EI_CLASS] != ELFCLASS32) || (header->e_machine != EM_AVR)) {
+		fprintf(stderr, "%s: not an AVR ELF file\n", file);
+		exit(2);
+	}
+
+	memset(avr.flash, 0xFF, sizeof(avr.flash));
+	memset(avr.eeprom, 0xFF, sizeof(avr.eeprom));
+	for (i = 0; i < header->e_phnum; i++) {
+		segment = (const Elf32_Phdr *)(elf + header->e_phoff + i * header->e_phentsize);
+		if ((segment->p_type != PT_LOAD) || (!segment->p_filesz))
+			continue;
+		if (segment->p_vaddr >= ELF_EEPROM) {
+			address = segment->p_vaddr - ELF_EEPROM;
+			if (address + segment->p_filesz <= AVR_EEPROM_SIZE)
+				memcpy(&avr.eeprom[address], elf + segment->p_offset, segment->p_filesz);
+		} else if (segment->p_paddr + segment->p_filesz <= sizeof(avr.flash)) {
+			memcpy((uint8_t *)avr.flash + segment->p_paddr, elf + segment->p_offset, segment->p_filesz);
+		} else {
+			fprintf(stderr, "%s: too big for the flash\n", file);
+			exit(2);
+		}
+	}
+
+	for (i = 0; i < header->e_shnum; i++) {
+		section = (const Elf32_Shdr *)(elf + header->e_shoff + i * header->e_shentsize);
+		if (section->sh_type != SHT_SYMTAB)
+			continue;
+		symbols = (const Elf32_Sym *)(elf + section->sh_offset);
+		symbol_count = section->sh_size / sizeof(Elf32_Sym);
+		section = (const Elf32_Shdr *)(elf + header->e_shoff + section->sh_link * header->e_shentsize);
+		symbol_names = (const char *)(elf + section->sh_offset);
+	}
+	if (!symbols) {
+		fprintf(stderr, "%s: no symbol table\n", file);
+		exit(2);
+	}
+}
+
+static const Elf32_Sym *symbol(const char *name) {
+	uint32_t i;
+
+	for (i = 0; i < symbol_count; i++)
+		if ((symbols[i].st_name) && (!strcmp(symbol_names + symbols[i].st_name, name)))
+			return &symbols[i];
+	return NULL;
+}
+
+static uint8_t vector(const char *name) {
+	// 0 if it isn't one
+	uint8_t i;
+
+	for (i = 1; i < AVR_VECTORS; i++)
+		if (!strcmp(vector_names[i], name))
+			return i;
+	return 0;
+}
+
+static uint8_t vector_used(uint8_t i) {
+	// The vector table entry jumps somewhere other than __bad_interrupt
+	const Elf32_Sym *bad = symbol("__bad_interrupt");
+	uint16_t op = avr.flash[i * AVR_VECTOR_WORDS];
+
+	if ((op & 0xFE0E) != 0x940C)
+		return 0;
+	return (!bad) || (avr.flash[i * AVR_VECTOR_WORDS + 1] != bad->st_value / 2);
+}
+
+static void set(avr_t *state, const char *setting, uint32_t line) {
+	// name=value, for a register r0-r31, an I/O register or a variable, little endian like avr-gcc
+	char name[64];
+	long value;
+	uint16_t address = 0;
+	uint8_t size = 0, i;
+	const Elf32_Sym *s;
+
+	if (sscanf(setting, "%63[^=]=%li", name, &value) != 2) {
+		fprintf(stderr, "line %u: expected name=value, not '%s'\n", line, setting);
+		exit(2);
+	}
+	if ((name[0] == 'r') && (sscanf(name + 1, "%hu", &address) == 1) && (address < 32)) {
+		size = 1;
+	} else {
+		for (i = 0; i < IO_NAMES; i++) {
+			if (!strcmp(io_names[i].name, name)) {
+				address = io_names[i].address;
+				size = io_names[i].size;
+			}
+		}
+	}
+	if ((!size) && ((s = symbol(name))) && (s->st_value >= ELF_DATA) && (s->st_value < ELF_EEPROM)) {
+		address = s->st_value - ELF_DATA;
+		size = (s->st_size > 4)?4:s->st_size;
+	}
+	if ((!size) || (address + size > AVR_DATA_SIZE)) {
+		fprintf(stderr, "line %u: no register or variable called '%s'\n", line, name);
+		exit(2);
+	}
+	for (i = 0; i < size; i++)
+		state->data[address + i] = value >> (i * 8);
+	if ((size == 1) && (address == AVR_ASSR)) {
+		// The busy bits say a Timer2 write is still on its way across
+		state->data[address] &= ~AVR_ASSR_BUSY;
+		avr_timer2_busy(state, value & AVR_ASSR_BUSY);
+	}
+}
+
+static uint8_t measure(const char *name, uint64_t *cycles) {
+	// Run one interrupt or function from the state already set up in avr, 0 if it didn't come back
+	const Elf32_Sym *s;
+	uint8_t v = vector(name), status;
+	uint16_t sp = avr_sp(&avr);
+	uint64_t start = avr.cycles;					// Keeps counting, the core has deadlines on it
+
+	if (v) {
+		avr_interrupt(&avr, v);
+	} else {
+		s = symbol(name);
+		if ((!s) || (s->st_value >= ELF_DATA)) {
+			printf("%-22s no such interrupt or function\n", name);
+			return 0;
+		}
+		avr_call(&avr, s->st_value / 2);
+	}
+	while (avr.cycles - start < CYCLES_LIMIT) {
+		status = avr_step(&avr);
+		if ((status == AVR_RETURN) && (avr_sp(&avr) >= sp)) {
+			*cycles = avr.cycles - start;
+			return 1;
+		}
+		if (status == AVR_BAD) {
+			printf("%-22s stopped at 0x%04x, %s\n", name, avr.pc * 2, avr.fault);
+			return 0;
+		}
+	}
+	printf("%-22s didn't return\n", name);
+	return 0;
+}
+
+static void boot(void) {
+	// Startup code and main() until it first goes to sleep, or gives up waiting
+	const Elf32_Sym *main_symbol = symbol("main");
+	uint8_t status = AVR_OK;
+
+	avr_reset(&avr);
+	while ((status == AVR_OK) || (status == AVR_RETURN)) {
+		if (avr.cycles >= CYCLES_STARTUP)
+			break;
+		status = avr_step(&avr);
+	}
+	if (status == AVR_BAD) {
+		fprintf(stderr, "startup stopped at 0x%04x, %s\n", avr.pc * 2, avr.fault);
+		exit(2);
+	}
+	printf("startup ran %llu cycles (%.1f ms)%s\n", (unsigned long long)avr.cycles,
+		avr.cycles * 1000.0 / CYCLES_F_CPU, (status == AVR_SLEEP)?" to the first sleep":", main() never slept");
+	if ((main_symbol) && (avr.pc * 2 < main_symbol->st_value))
+		printf("warning: never got as far as main()\n");
+	booted = avr;
+}
+
+int main(int argc, char **argv) {
+	FILE *f, *out = NULL;
+	char text[256], original[256], state[256], budget_text[16], *field[2 + CYCLES_SETTINGS], *comment;
+	char updated[1024];
+	uint32_t line = 0, budget, failed = 0, unbudgeted = 0, count, i;
+	uint64_t cycles;
+	uint8_t v, update = 0;
+
+	if ((argc == 4) && (!strcmp(argv[1], "-u"))) {
+		update = 1;
+		argv++;
+		argc--;
+	}
+	if (argc != 3) {
+		fprintf(stderr, "usage: cycles [-u] firmware.elf budgets\n");
+		return 2;
+	}
+	load(argv[1]);
+	if (!(f = fopen(argv[2], "r"))) {
+		perror(argv[2]);
+		return 2;
+	}
+	if (update) {
+		snprintf(updated, sizeof(updated), "%s.new", argv[2]);
+		if (!(out = fopen(updated, "w"))) {
+			perror(updated);
+			return 2;
+		}
+	}
+	boot();
+
+	printf("%-22s %-28s %8s %9s %8s\n", "", "state", "cycles", "us", "budget");
+	while (fgets(text, sizeof(text), f)) {
+		// name budget [setting ...], # starts a comment
+		line++;
+		strcpy(original, text);
+		if ((comment = strchr(text, '#')))
+			*comment = 0;
+		count = 0;
+		for (field[0] = strtok(text, " \t\r\n"); (field[count]) && (count < 2 + CYCLES_SETTINGS); )
+			field[++count] = strtok(NULL, " \t\r\n");
+		if (!count) {
+			if (out)
+				fputs(original, out);
+			continue;
+		}
+		if ((count >= 2) && (!strcmp(field[1], "-"))) {
+			budget = CYCLES_NO_BUDGET;
+		} else if ((count < 2) || (sscanf(field[1], "%u", &budget) != 1)) {
+			fprintf(stderr, "line %u: expected a name and a budget\n", line);
+			return 2;
+		}
+
+		avr = booted;
+		state[0] = 0;
+		for (i = 2; i < count; i++) {
+			set(&avr, field[i], line);
+			if (i > 2)
+				strcat(state, " ");
+			strcat(state, field[i]);
+		}
+		if ((v = vector(field[0])))
+			vector_listed[v] = 1;
+		if (!measure(field[0], &cycles)) {
+			failed++;
+			if (out)
+				fputs(original, out);
+			continue;
+		}
+		if (budget == CYCLES_NO_BUDGET)
+			strcpy(budget_text, "-");
+		else
+			snprintf(budget_text, sizeof(budget_text), "%u", budget);
+		printf("%-22s %-28s %8llu %9.2f %8s%s\n", field[0], state, (unsigned long long)cycles,
+			cycles * 1e6 / CYCLES_F_CPU, budget_text, (cycles > budget)?"  over budget":"");
+		if (out) {
+			// Same line with the new budget in place of the old one
+			i = field[1] - text;
+			fprintf(out, "%.*s%llu%s", (int)i, original, (unsigned long long)CYCLES_HEADROOM(cycles),
+				original + i + strlen(field[1]));
+		} else if (budget == CYCLES_NO_BUDGET) {
+			unbudgeted++;
+		} else if (cycles > budget) {
+			failed++;
+		}
+	}
+	fclose(f);
+	if (out) {
+		fclose(out);
+		if (rename(updated, argv[2])) {
+			perror(argv[2]);
+			return 2;
+		}
+	}
+
+	// Anything the firmware handles that has no budget yet
+	for (v = 1; v < AVR_VECTORS; v++) {
+		if ((!vector_used(v)) || (vector_listed[v]))
+			continue;
+		avr = booted;
+		if (measure(vector_names[v], &cycles))
+			printf("%-22s %-28s %8llu %9.2f %8s\n", vector_names[v], "", (unsigned long long)cycles,
+				cycles * 1e6 / CYCLES_F_CPU, "none");
+	}
+
+	if (failed)
+		printf("%u over budget or didn't return\n", failed);
+	if (unbudgeted)
+		printf("%u with no budget, run make cycles-update on an avr-gcc build and check them in\n", unbudgeted);
+	return ((failed) || (unbudgeted))?1:0;
+}
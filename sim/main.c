@@ -0,0 +1,103 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Command line for the host simulation, see sim.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+
+#define SIM_DAYS		365				// How long to run for if not told
+
+int firmware_main(void);					// The firmware's main(), renamed by the Makefile
+
+static void sim_usage(void) {
+	fprintf(stderr,
+		"usage: nixieclock-sim [-p] [-t] [-v file.vcd] [-d days] [-s seconds] [-f at,length] [-b set|adv,at,length]...\n"
+		"  -p  run the display PWM timer, a lot slower\n"
+		"  -t  trace the display pins and summarize the port writes, implies -p\n"
+		"  -v  trace the display pins into a VCD file as well, implies -p\n"
+		"  -d  simulate this many days (default %d)\n"
+		"  -s  simulate this many seconds\n"
+		"  -f  fail the power at 'at' seconds for 'length' seconds\n"
+		"  -b  hold a button down at 'at' seconds for 'length' seconds\n"
+		"inputs are given in time order\n", SIM_DAYS);
+	exit(2);
+}
+
+static double sim_seconds(const char *text) {
+	char *end;
+	double seconds = strtod(text, &end);
+
+	if ((end == text) || (seconds < 0)) {
+		fprintf(stderr, "bad time '%s'\n", text);
+		exit(2);
+	}
+	return seconds;
+}
+
+int main(int argc, char **argv) {
+	double at, length;
+	char button[4];
+	const char *vcd = NULL;
+	int i, trace = 0;
+
+	sim_end = SIM_DAYS * 86400 * SIM_CYCLES_PER_SECOND;
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-p")) {
+			sim_display = 1;
+		} else if (!strcmp(argv[i], "-t")) {
+			sim_display = 1;
+			trace = 1;
+		} else if ((!strcmp(argv[i], "-v")) && (i + 1 < argc)) {
+			sim_display = 1;
+			trace = 1;
+			vcd = argv[++i];
+		} else if ((!strcmp(argv[i], "-d")) && (i + 1 < argc)) {
+			sim_end = sim_seconds(argv[++i]) * 86400 * SIM_CYCLES_PER_SECOND;
+		} else if ((!strcmp(argv[i], "-s")) && (i + 1 < argc)) {
+			sim_end = sim_seconds(argv[++i]) * SIM_CYCLES_PER_SECOND;
+		} else if ((!strcmp(argv[i], "-f")) && (i + 1 < argc)) {
+			if (sscanf(argv[++i], "%lf,%lf", &at, &length) != 2)
+				sim_usage();
+			sim_schedule(SIM_PIND, PD2, at, length);
+		} else if ((!strcmp(argv[i], "-b")) && (i + 1 < argc)) {
+			if (sscanf(argv[++i], "%3[a-z],%lf,%lf", button, &at, &length) != 3)
+				sim_usage();
+			if (!strcmp(button, "set"))
+				sim_schedule(SIM_PIND, PD7, at, length);
+			else if (!strcmp(button, "adv"))
+				sim_schedule(SIM_PINC, PC0, at, length);
+			else
+				sim_usage();
+		} else {
+			sim_usage();
+		}
+	}
+
+	sim_reset();
+	if (trace)
+		sim_trace_start(vcd);
+	firmware_main();
+	return 0;
+}
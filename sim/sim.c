@@ -0,0 +1,467 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+// Host simulation of the clock, built with make sim, the command line is in main.c
+// The firmware in system/ is compiled unchanged against the headers in sim/ and its main() runs as
+// firmware_main(). Code takes no simulated time, time only passes while the firmware sleeps, when
+// the timers, EEPROM and inputs are stepped to the next thing that happens and the interrupts it
+// raises are called. A year goes by in under a minute with the display timer stopped.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "sim.h"
+#include "../include/rtc.h"
+
+#define SIM_REG(address)	sim_io_space[address]
+#define SIM_REG16(address)	(*(uint16_t *)&sim_io_space[address])
+
+#define SIM_INPUTS		64
+
+uint8_t sim_io_space[SIM_IO_SIZE] __attribute__ ((aligned (2)));
+uint8_t sim_eeprom[512];
+uint64_t sim_now = 0;
+
+// Registers that do something when written or count on their own, the rest are left to the firmware
+// The trace adds the ports
+uint8_t sim_watched[SIM_IO_SIZE] = {
+	[SIM_EECR] = 1, [SIM_TCNT2] = 1, [SIM_TCCR2] = 1, [SIM_TCNT1] = 1, [SIM_TCNT1 + 1] = 1,
+	[SIM_TCCR1B] = 1, [SIM_TCNT0] = 1, [SIM_TCCR0] = 1, [SIM_TIFR] = 1, [SIM_GIFR] = 1,
+};
+
+// What the watched registers held when the simulator last looked, a difference means the firmware wrote it
+// Only the last one handed out can have been written since
+static uint8_t sim_shadow[SIM_IO_SIZE];
+int16_t sim_accessed = -1;
+static uint8_t sim_accessed_size;
+
+// Timer1 only runs the display, it interrupts 366 times a second so it is left stopped unless asked for
+uint8_t sim_display = 0;
+
+// Timer0, overflow only
+static uint8_t t0_on;
+static uint64_t t0_base;						// When TCNT0 was 0
+
+// Timer1, fast PWM with ICR1 as TOP, the compares are double buffered and load at TOP
+static uint8_t t1_on;
+static uint64_t t1_base;						// When TCNT1 was 0 this period
+static uint16_t t1_ocr1a, t1_ocr1b;
+static uint8_t t1_fired;						// Events already raised this period
+#define T1_COMPA	(1 << 0)
+#define T1_COMPB	(1 << 1)
+#define T1_TOP		(1 << 2)
+
+// Timer2, asynchronous from the watch crystal
+static uint8_t t2_on;
+static uint64_t t2_base;						// When TCNT2 was 0 this second
+static uint64_t t2_done;						// Last compare raised
+
+// EEPROM, the byte being written finishes at ee_busy
+static uint64_t ee_busy = 0;
+
+// Inputs driven from the command line
+typedef struct _sim_input_t {
+	uint64_t	when;
+	uint8_t		address;
+	uint8_t		bit;
+	uint8_t		level;
+} sim_input_t;
+
+static sim_input_t sim_inputs[SIM_INPUTS];
+static uint8_t sim_input_count = 0, sim_input_next = 0;
+
+// Interrupt vectors in priority order
+typedef struct _sim_vector_t {
+	const char	*name;
+	void		(*vector)(void);
+	uint8_t		flag_address;					// 0 for EE_RDY, which is pending whenever the EEPROM is idle
+	uint8_t		flag;
+	uint8_t		enable_address;
+	uint8_t		enable;
+} sim_vector_t;
+
+static const sim_vector_t sim_vectors[] = {
+	{ "INT0",			INT0_vect,			SIM_GIFR,	(1 << INTF0),	SIM_GICR,	(1 << INT0) },
+	{ "TIMER2_COMP",	TIMER2_COMP_vect,	SIM_TIFR,	(1 << OCF2),	SIM_TIMSK,	(1 << OCIE2) },
+	{ "TIMER2_OVF",		TIMER2_OVF_vect,	SIM_TIFR,	(1 << TOV2),	SIM_TIMSK,	(1 << TOIE2) },
+	{ "TIMER1_COMPA",	TIMER1_COMPA_vect,	SIM_TIFR,	(1 << OCF1A),	SIM_TIMSK,	(1 << OCIE1A) },
+	{ "TIMER1_COMPB",	TIMER1_COMPB_vect,	SIM_TIFR,	(1 << OCF1B),	SIM_TIMSK,	(1 << OCIE1B) },
+	{ "TIMER1_OVF",		TIMER1_OVF_vect,	SIM_TIFR,	(1 << TOV1),	SIM_TIMSK,	(1 << TOIE1) },
+	{ "TIMER0_OVF",		TIMER0_OVF_vect,	SIM_TIFR,	(1 << TOV0),	SIM_TIMSK,	(1 << TOIE0) },
+	{ "EE_RDY",			EE_RDY_vect,		0,			0,				SIM_EECR,	(1 << EERIE) },
+};
+#define SIM_VECTORS		(sizeof(sim_vectors) / sizeof(sim_vectors[0]))
+
+// Counters for the summary
+static uint64_t sim_vector_count[SIM_VECTORS];
+static uint64_t sim_wakeups = 0, sim_eeprom_writes = 0;
+uint64_t sim_end;
+static uint32_t sim_boot_seconds;
+static uint8_t sim_booted = 0;
+static struct timeval sim_started;
+
+static void sim_set_flag(uint8_t address, uint8_t flag) {
+	SIM_REG(address) |= flag;
+	sim_shadow[address] = SIM_REG(address);
+}
+
+static void sim_written(uint8_t address, uint8_t old) {
+	// The firmware wrote a watched register, do what the hardware would
+	uint8_t value = SIM_REG(address);
+
+	switch (address) {
+		case SIM_TIFR:
+		case SIM_GIFR:
+			// Writing a one clears the flag
+			SIM_REG(address) = old & ~value;
+			break;
+		case SIM_EECR:
+			if (value & (1 << EERE)) {
+				SIM_REG(SIM_EEDR) = sim_eeprom[SIM_REG16(SIM_EEAR) & 511];
+				SIM_REG(address) &= ~(1 << EERE);
+			}
+			if ((value & (1 << EEWE)) && (!(old & (1 << EEWE)))) {
+				if (old & (1 << EEMWE)) {
+					sim_eeprom[SIM_REG16(SIM_EEAR) & 511] = SIM_REG(SIM_EEDR);
+					ee_busy = sim_now + SIM_EEPROM_WRITE;
+					sim_eeprom_writes++;
+				} else {
+					SIM_REG(address) &= ~(1 << EEWE);	// EEMWE wasn't set first, nothing happens
+				}
+			}
+			if (old & (1 << EEMWE))
+				SIM_REG(address) &= ~(1 << EEMWE);		// Only lasts four cycles
+			break;
+		case SIM_TCNT0:
+			t0_base = sim_now - (uint64_t)value * SIM_TIMER0_TICK;
+			break;
+		case SIM_TCCR0:
+			t0_on = (value & 0x07) != 0;
+			t0_base = sim_now - (uint64_t)SIM_REG(SIM_TCNT0) * SIM_TIMER0_TICK;
+			break;
+		case SIM_TCNT1:
+		case SIM_TCNT1 + 1:
+			t1_base = sim_now - (uint64_t)SIM_REG16(SIM_TCNT1) * SIM_TIMER1_TICK;
+			t1_fired = 0;
+			break;
+		case SIM_TCCR1B:
+			t1_on = (sim_display) && ((value & 0x07) != 0);
+			t1_base = sim_now - (uint64_t)SIM_REG16(SIM_TCNT1) * SIM_TIMER1_TICK;
+			t1_ocr1a = SIM_REG16(SIM_OCR1A);
+			t1_ocr1b = SIM_REG16(SIM_OCR1B);
+			t1_fired = 0;
+			break;
+		case SIM_TCNT2:
+			// Keeps the phase within the tick, the firmware only nudges it by one
+			t2_base += ((int64_t)old - value) * SIM_TIMER2_TICK;
+			break;
+		case SIM_TCCR2:
+			t2_on = (value & 0x07) != 0;
+			t2_base = sim_now - (uint64_t)SIM_REG(SIM_TCNT2) * SIM_TIMER2_TICK;
+			t2_done = sim_now;
+			break;
+		case SIM_PORTA:
+		case SIM_PORTB:
+		case SIM_PORTC:
+		case SIM_PORTD:
+			sim_trace_write(address, value);
+			break;
+	}
+	sim_shadow[address] = SIM_REG(address);
+}
+
+static void sim_flush(void) {
+	// Pick up a write to the last register the firmware was handed
+	uint8_t i;
+
+	if (sim_accessed < 0)
+		return;
+	for (i = 0; i < sim_accessed_size; i++) {
+		if (SIM_REG(sim_accessed + i) != sim_shadow[sim_accessed + i])
+			sim_written(sim_accessed + i, sim_shadow[sim_accessed + i]);
+	}
+	sim_accessed = -1;
+}
+
+static void sim_refresh(uint8_t address) {
+	// Bring a register that counts on its own up to now before the firmware looks at it
+	uint64_t count;
+
+	switch (address) {
+		case SIM_TCNT0:
+			if (t0_on)
+				SIM_REG(address) = (sim_now - t0_base) / SIM_TIMER0_TICK;
+			break;
+		case SIM_TCNT1:
+		case SIM_TCNT1 + 1:
+			if (t1_on) {
+				count = (sim_now < t1_base)?SIM_REG16(SIM_ICR1):(sim_now - t1_base) / SIM_TIMER1_TICK;
+				SIM_REG16(SIM_TCNT1) = (count > SIM_REG16(SIM_ICR1))?SIM_REG16(SIM_ICR1):count;
+				sim_shadow[SIM_TCNT1 + 1] = SIM_REG(SIM_TCNT1 + 1);
+			}
+			break;
+		case SIM_TCNT2:
+			if (t2_on) {
+				count = (sim_now - t2_base) / SIM_TIMER2_TICK;
+				SIM_REG(address) = (count > 255)?255:count;
+			}
+			break;
+		case SIM_EECR:
+			if ((ee_busy) && (sim_now >= ee_busy)) {
+				SIM_REG(address) &= ~(1 << EEWE);
+				ee_busy = 0;
+			}
+			break;
+		default:
+			return;
+	}
+	sim_shadow[address] = SIM_REG(address);
+}
+
+void sim_access(uint8_t address, uint8_t size) {
+	// The firmware is about to touch a register, called from sim_io8()/sim_io16() in avr/io.h
+	sim_flush();
+	if (!sim_watched[address])
+		return;
+	sim_refresh(address);
+	sim_accessed = address;
+	sim_accessed_size = size;
+}
+
+static uint64_t sim_t1_next(uint8_t *event) {
+	// Next Timer1 event this period, a compare past TOP never matches
+	uint16_t top = SIM_REG16(SIM_ICR1);
+	uint16_t position = top;
+
+	*event = T1_TOP;
+	if ((!(t1_fired & T1_COMPB)) && (t1_ocr1b <= position)) {
+		position = t1_ocr1b;
+		*event = T1_COMPB;
+	}
+	if ((!(t1_fired & T1_COMPA)) && (t1_ocr1a <= position)) {
+		position = t1_ocr1a;
+		*event = T1_COMPA;
+	}
+	return t1_base + (uint64_t)position * SIM_TIMER1_TICK;
+}
+
+static uint64_t sim_t2_next(uint8_t *compare) {
+	// The compare if it's still to come this second, otherwise the overflow
+	uint64_t when = t2_base + (uint64_t)SIM_REG(SIM_OCR2) * SIM_TIMER2_TICK;
+
+	*compare = (when > t2_done);
+	return (*compare)?when:t2_base + 256 * SIM_TIMER2_TICK;
+}
+
+static uint64_t sim_next(void) {
+	// When the next thing happens
+	uint64_t next = sim_end, when;
+	uint8_t event;
+
+	if (t0_on) {
+		when = t0_base + 256 * SIM_TIMER0_TICK;
+		if (when < next)
+			next = when;
+	}
+	if (t1_on) {
+		when = sim_t1_next(&event);
+		if (when < next)
+			next = when;
+	}
+	if (t2_on) {
+		when = sim_t2_next(&event);
+		if (when < next)
+			next = when;
+	}
+	if ((ee_busy) && (ee_busy < next))
+		next = ee_busy;
+	if ((sim_input_next < sim_input_count) && (sim_inputs[sim_input_next].when < next))
+		next = sim_inputs[sim_input_next].when;
+	return next;
+}
+
+static void sim_input(sim_input_t *input) {
+	// Drive an input pin, the power fail sense on PD2 is INT0
+	uint8_t was = SIM_REG(input->address);
+
+	if (input->level)
+		SIM_REG(input->address) |= (1 << input->bit);
+	else
+		SIM_REG(input->address) &= ~(1 << input->bit);
+	if ((input->address == SIM_PIND) && (input->bit == PD2) && (was != SIM_REG(SIM_PIND))) {
+		switch (SIM_REG(SIM_MCUCR) & ((1 << ISC01) | (1 << ISC00))) {
+			case (1 << ISC00):
+				sim_set_flag(SIM_GIFR, (1 << INTF0));
+				break;
+			case (1 << ISC01):
+				if (!input->level)
+					sim_set_flag(SIM_GIFR, (1 << INTF0));
+				break;
+			case (1 << ISC01) | (1 << ISC00):
+				if (input->level)
+					sim_set_flag(SIM_GIFR, (1 << INTF0));
+				break;
+		}
+	}
+	sim_shadow[input->address] = SIM_REG(input->address);
+}
+
+static void sim_raise(void) {
+	// Raise everything that is due by now
+	uint8_t event;
+
+	while (1) {
+		if ((t0_on) && (t0_base + 256 * SIM_TIMER0_TICK <= sim_now)) {
+			t0_base += 256 * SIM_TIMER0_TICK;
+			sim_set_flag(SIM_TIFR, (1 << TOV0));
+		} else if ((t1_on) && (sim_t1_next(&event) <= sim_now)) {
+			t1_fired |= event;
+			if (event == T1_COMPA) {
+				sim_set_flag(SIM_TIFR, (1 << OCF1A));
+			} else if (event == T1_COMPB) {
+				sim_set_flag(SIM_TIFR, (1 << OCF1B));
+			} else {
+				// ICR1 is TOP so the capture flag sets too, nothing clears it but it means a write
+				// of a single flag to TIFR always differs from what's there and gets picked up
+				sim_set_flag(SIM_TIFR, (1 << TOV1) | (1 << ICF1));
+				if (sim_tracing)
+					sim_trace_period();
+				t1_base += ((uint64_t)SIM_REG16(SIM_ICR1) + 1) * SIM_TIMER1_TICK;
+				t1_ocr1a = SIM_REG16(SIM_OCR1A);
+				t1_ocr1b = SIM_REG16(SIM_OCR1B);
+				t1_fired = 0;
+			}
+		} else if ((t2_on) && (sim_t2_next(&event) <= sim_now)) {
+			if (event) {
+				t2_done = sim_t2_next(&event);
+				sim_set_flag(SIM_TIFR, (1 << OCF2));
+			} else {
+				t2_base += 256 * SIM_TIMER2_TICK;
+				sim_set_flag(SIM_TIFR, (1 << TOV2));
+			}
+		} else if ((ee_busy) && (ee_busy <= sim_now)) {
+			sim_refresh(SIM_EECR);
+		} else if ((sim_input_next < sim_input_count) && (sim_inputs[sim_input_next].when <= sim_now)) {
+			sim_input(&sim_inputs[sim_input_next++]);
+		} else {
+			break;
+		}
+	}
+}
+
+static uint8_t sim_dispatch(void) {
+	// Call every pending interrupt that is enabled, highest priority first, how many ran
+	uint8_t i, ran = 0;
+	const sim_vector_t *v;
+
+	i = 0;
+	while (i < SIM_VECTORS) {
+		v = &sim_vectors[i];
+		if (v->flag_address) {
+			if ((!(SIM_REG(v->flag_address) & v->flag)) || (!(SIM_REG(v->enable_address) & v->enable))) {
+				i++;
+				continue;
+			}
+			SIM_REG(v->flag_address) &= ~v->flag;		// Cleared as the vector is taken
+			sim_shadow[v->flag_address] = SIM_REG(v->flag_address);
+		} else {
+			sim_refresh(SIM_EECR);
+			if ((!(SIM_REG(SIM_EECR) & v->enable)) || (SIM_REG(SIM_EECR) & (1 << EEWE))) {
+				i++;
+				continue;
+			}
+		}
+		v->vector();
+		sim_flush();
+		sim_vector_count[i]++;
+		ran++;
+		i = 0;											// Start over from the top
+	}
+	return ran;
+}
+
+static void sim_finish(void) {
+	// Out of time, say what happened
+	struct timeval finished;
+	double wall, simulated;
+	uint8_t i;
+
+	gettimeofday(&finished, NULL);
+	wall = (finished.tv_sec - sim_started.tv_sec) + (finished.tv_usec - sim_started.tv_usec) / 1e6;
+	simulated = (double)sim_now / SIM_CYCLES_PER_SECOND;
+
+	printf("simulated %.0f seconds (%.2f days) in %.2f seconds, %.0fx real time\n",
+		simulated, simulated / 86400, wall, (wall > 0)?simulated / wall:0);
+	printf("clock %04u-%02u-%02u %02u:%02u:%02u day %u, rtc_seconds advanced %d seconds more than simulated\n",
+		clock.year + 2000, clock.month, clock.date, clock.hour, clock.minute, clock.second, clock.day,
+		(int32_t)(rtc_seconds - sim_boot_seconds - (uint32_t)simulated));
+	printf("main loop woke %llu times, %llu EEPROM bytes written\n",
+		(unsigned long long)sim_wakeups, (unsigned long long)sim_eeprom_writes);
+	for (i = 0; i < SIM_VECTORS; i++)
+		printf("%-14s %llu\n", sim_vectors[i].name, (unsigned long long)sim_vector_count[i]);
+	if (sim_tracing)
+		sim_trace_finish();
+	exit(0);
+}
+
+void sim_sleep(void) {
+	// The firmware is waiting for an interrupt, run time forward until one is taken
+	sim_flush();
+	if (!sim_booted) {
+		sim_booted = 1;
+		sim_boot_seconds = rtc_seconds;
+	}
+	sim_wakeups++;
+	while (1) {
+		sim_raise();
+		if (sim_dispatch())
+			return;
+		if (sim_now >= sim_end)
+			sim_finish();
+		sim_now = sim_next();
+	}
+}
+
+void sim_schedule(uint8_t address, uint8_t bit, double at, double length) {
+	// Pull an active low input down at 'at' for 'length' seconds
+	if (sim_input_count + 2 > SIM_INPUTS) {
+		fprintf(stderr, "too many inputs\n");
+		exit(2);
+	}
+	if ((sim_input_count) && (at * SIM_CYCLES_PER_SECOND < sim_inputs[sim_input_count - 1].when)) {
+		fprintf(stderr, "inputs have to be given in time order\n");
+		exit(2);
+	}
+	sim_inputs[sim_input_count++] = (sim_input_t){ at * SIM_CYCLES_PER_SECOND, address, bit, 0 };
+	sim_inputs[sim_input_count++] = (sim_input_t){ (at + length) * SIM_CYCLES_PER_SECOND, address, bit, 1 };
+}
+
+void sim_reset(void) {
+	// Erased EEPROM, power on reset, buttons up and the power good
+	memset(sim_eeprom, 0xFF, sizeof(sim_eeprom));
+	SIM_REG(SIM_MCUCSR) = (1 << PORF);
+	SIM_REG(SIM_PIND) = (1 << PD2) | (1 << PD7);
+	SIM_REG(SIM_PINC) = (1 << PC0);
+	memcpy(sim_shadow, sim_io_space, sizeof(sim_shadow));
+	gettimeofday(&sim_started, NULL);
+}
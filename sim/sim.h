@@ -0,0 +1,76 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+#ifndef __SIM_H_
+#define __SIM_H_
+
+#include <stdint.h>
+
+// Simulated time is counted in CPU cycles
+#define SIM_CYCLES_PER_SECOND	((uint64_t)F_CPU)
+#define SIM_TIMER0_TICK			1024								// clk/1024
+#define SIM_TIMER1_TICK			8									// clk/8
+#define SIM_TIMER2_TICK			(F_CPU / 256)						// 32.768KHz/128, 256 a second
+#define SIM_EEPROM_WRITE		(F_CPU / 1000 * 85 / 10)			// 8.5ms per byte
+
+// Register addresses, the firmware goes through the macros in avr/io.h but the simulator doesn't
+#define SIM_PIND	0x30
+#define SIM_PORTD	0x32
+#define SIM_PINC	0x33
+#define SIM_PORTC	0x35
+#define SIM_PORTB	0x38
+#define SIM_PORTA	0x3B
+#define SIM_EECR	0x3C
+#define SIM_EEDR	0x3D
+#define SIM_EEAR	0x3E
+#define SIM_OCR2	0x43
+#define SIM_TCNT2	0x44
+#define SIM_TCCR2	0x45
+#define SIM_ICR1	0x46
+#define SIM_OCR1B	0x48
+#define SIM_OCR1A	0x4A
+#define SIM_TCNT1	0x4C
+#define SIM_TCCR1B	0x4E
+#define SIM_TCNT0	0x52
+#define SIM_TCCR0	0x53
+#define SIM_MCUCSR	0x54
+#define SIM_MCUCR	0x55
+#define SIM_TIFR	0x58
+#define SIM_TIMSK	0x59
+#define SIM_GIFR	0x5A
+#define SIM_GICR	0x5B
+
+extern uint64_t sim_now;
+extern uint64_t sim_end;								// When sim_sleep() gives up and prints the summary
+extern uint8_t sim_display;								// Run Timer1, off unless asked for
+extern uint8_t sim_eeprom[512];
+
+void sim_reset(void);
+void sim_schedule(uint8_t address, uint8_t bit, double at, double length);
+void sim_sleep(void);
+
+// Display pin trace, in trace.c
+extern uint8_t sim_tracing;
+
+void sim_trace_start(const char *vcd);
+void sim_trace_write(uint8_t address, uint8_t value);
+void sim_trace_period(void);
+void sim_trace_finish(void);
+
+#endif // __SIM_H_
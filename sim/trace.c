@@ -0,0 +1,275 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+// Display pin trace for the host simulation, sim/nixieclock-sim -v file.vcd or -t
+// Every write to PORTA-PORTD is recorded with its simulated time and the tubes are decoded from
+// the pins the way display.h lays them out. Code takes no simulated time, so writes made together
+// are spread SIM_TRACE_WRITE cycles apart to keep their order visible, the same as the chip doing
+// one port at a time. A code a tube only shows between two of those writes is a transient, like
+// minutes ones with 'a' still on the old digit after PORTB and before PORTD.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "sim.h"
+#include "../include/display.h"
+
+#define SIM_TRACE_WRITE		3					// Cycles for a load and an out
+#define SIM_TRACE_NS		(1000000000UL / F_CPU)	// VCD time is in ns
+#define SIM_TRACE_TUBES		6
+#define SIM_TRACE_BLANK		0x0F				// All four lines high, the tube is dark
+
+// Which port and pin each BCD line of a tube is on, a through d
+typedef struct _sim_tube_t {
+	const char	*name;
+	uint8_t		port[4];					// 0 is PORTA through 3 PORTD
+	uint8_t		pin[4];
+} sim_tube_t;
+
+static const sim_tube_t sim_tubes[SIM_TRACE_TUBES] = {
+	{ "hour_ten",	{ 0, 0, 0, 0 },	{ hour_ten_a, hour_ten_b, hour_ten_c, hour_ten_d } },
+	{ "hour_one",	{ 0, 0, 0, 0 },	{ hour_one_a, hour_one_b, hour_one_c, hour_one_d } },
+	{ "min_ten",	{ 1, 1, 1, 1 },	{ min_ten_a, min_ten_b, min_ten_c, min_ten_d } },
+	{ "min_one",	{ 3, 1, 1, 1 },	{ min_one_a, min_one_b, min_one_c, min_one_d } },
+	{ "sec_ten",	{ 3, 3, 3, 3 },	{ sec_ten_a, sec_ten_b, sec_ten_c, sec_ten_d } },
+	{ "sec_one",	{ 2, 2, 2, 2 },	{ sec_one_a, sec_one_b, sec_one_c, sec_one_d } },
+};
+
+uint8_t sim_tracing = 0;
+static FILE *sim_vcd = NULL;
+static uint64_t sim_vcd_time = 0;
+
+// Pin state as the simulator last saw it
+static uint8_t trace_port[4];
+static uint8_t trace_tube[SIM_TRACE_TUBES];
+static uint8_t trace_colons, trace_lit;
+
+// Writes made at the same simulated time, the transients are found when the batch is over
+static uint64_t batch_time = 0;
+static uint8_t batch_writes = 0;
+static uint8_t batch_start[SIM_TRACE_TUBES];
+static uint8_t batch_seen[SIM_TRACE_TUBES][16];
+
+// Per PWM period
+static uint64_t lit_since = 0, lit_time = 0;
+static uint32_t period_writes = 0;
+
+// Summary
+static uint64_t trace_writes[4], trace_periods = 0;
+static uint32_t period_writes_min = 0xFFFFFFFF, period_writes_max = 0;
+static uint64_t period_writes_total = 0;
+static uint64_t period_lit_min = UINT64_MAX, period_lit_max = 0, period_lit_total = 0;
+static uint64_t transients[SIM_TRACE_TUBES][16];
+
+static uint8_t trace_decode(uint8_t tube) {
+	// The code on a tube's four lines, a is the 1's bit
+	const sim_tube_t *t = &sim_tubes[tube];
+	uint8_t i, code = 0;
+
+	for (i = 0; i < 4; i++)
+		if (trace_port[t->port[i]] & _BV(t->pin[i]))
+			code |= (1 << i);
+	return code;
+}
+
+static void vcd_value(uint8_t value, uint8_t width, char id) {
+	char bits[9];
+	uint8_t i;
+
+	if (width == 1) {
+		fprintf(sim_vcd, "%u%c\n", value & 1, id);
+		return;
+	}
+	for (i = 0; i < width; i++)
+		bits[i] = (value & (1 << (width - 1 - i)))?'1':'0';
+	bits[width] = 0;
+	fprintf(sim_vcd, "b%s %c\n", bits, id);
+}
+
+static void vcd_dump(uint64_t time, uint8_t all) {
+	// Everything that changed, or everything for the first dump
+	static uint8_t last_port[4], last_tube[SIM_TRACE_TUBES], last_colons, last_lit;
+	uint8_t i;
+
+	if (time < sim_vcd_time)
+		time = sim_vcd_time;
+	if ((all) || (time != sim_vcd_time))
+		fprintf(sim_vcd, "#%llu\n", (unsigned long long)(time * SIM_TRACE_NS));
+	sim_vcd_time = time;
+	for (i = 0; i < 4; i++)
+		if ((all) || (trace_port[i] != last_port[i]))
+			vcd_value(trace_port[i], 8, '!' + i);
+	for (i = 0; i < SIM_TRACE_TUBES; i++)
+		if ((all) || (trace_tube[i] != last_tube[i]))
+			vcd_value(trace_tube[i], 4, '%' + i);
+	if ((all) || ((trace_colons ^ last_colons) & 1))
+		vcd_value(trace_colons, 1, '+');
+	if ((all) || ((trace_colons ^ last_colons) & 2))
+		vcd_value(trace_colons >> 1, 1, ',');
+	if ((all) || (trace_lit != last_lit))
+		vcd_value(trace_lit, 1, '-');
+	memcpy(last_port, trace_port, sizeof(last_port));
+	memcpy(last_tube, trace_tube, sizeof(last_tube));
+	last_colons = trace_colons;
+	last_lit = trace_lit;
+}
+
+static void trace_batch_end(void) {
+	// Anything a tube showed during the batch that it didn't start or finish on was only there in between
+	uint8_t i, code;
+
+	if (!batch_writes)
+		return;
+	for (i = 0; i < SIM_TRACE_TUBES; i++) {
+		for (code = 0; code < 16; code++) {
+			if ((batch_seen[i][code]) && (code != batch_start[i]) && (code != trace_tube[i]))
+				transients[i][code]++;
+		}
+	}
+	batch_writes = 0;
+}
+
+void sim_trace_write(uint8_t address, uint8_t value) {
+	// The firmware wrote one of the ports, called from sim.c
+	uint8_t port, i, lit = 0;
+
+	switch (address) {
+		case SIM_PORTA:	port = 0; break;
+		case SIM_PORTB:	port = 1; break;
+		case SIM_PORTC:	port = 2; break;
+		default:		port = 3; break;
+	}
+	if (sim_now != batch_time) {
+		trace_batch_end();
+		batch_time = sim_now;
+	}
+	if (!batch_writes) {
+		memcpy(batch_start, trace_tube, sizeof(batch_start));
+		memset(batch_seen, 0, sizeof(batch_seen));
+	}
+
+	trace_writes[port]++;
+	period_writes++;
+	trace_port[port] = value;
+	for (i = 0; i < SIM_TRACE_TUBES; i++) {
+		trace_tube[i] = trace_decode(i);
+		batch_seen[i][trace_tube[i]] = 1;
+		lit |= (trace_tube[i] < 10);
+	}
+	trace_colons = ((trace_port[3] & _BV(rcol_pin))?1:0) | ((trace_port[1] & _BV(lcol_pin))?2:0);
+	if (lit != trace_lit) {
+		if (lit)
+			lit_since = sim_now;
+		else
+			lit_time += sim_now - lit_since;
+		trace_lit = lit;
+	}
+	if (sim_vcd)
+		vcd_dump(sim_now + (uint64_t)batch_writes * SIM_TRACE_WRITE, 0);
+	batch_writes++;
+}
+
+void sim_trace_period(void) {
+	// Timer1 reached TOP, close off the period that just ended
+	uint64_t lit;
+
+	trace_batch_end();
+	if (trace_lit) {
+		lit_time += sim_now - lit_since;
+		lit_since = sim_now;
+	}
+	lit = lit_time;
+	if (trace_periods++) {
+		// The first one started whenever the trace did
+		if (period_writes < period_writes_min)
+			period_writes_min = period_writes;
+		if (period_writes > period_writes_max)
+			period_writes_max = period_writes;
+		if (lit < period_lit_min)
+			period_lit_min = lit;
+		if (lit > period_lit_max)
+			period_lit_max = lit;
+		period_lit_total += lit;
+		period_writes_total += period_writes;
+	}
+	period_writes = 0;
+	lit_time = 0;
+}
+
+void sim_trace_start(const char *vcd) {
+	// Start watching the ports, and write a VCD file if given one
+	uint8_t i;
+
+	sim_tracing = 1;
+	sim_watched[SIM_PORTA] = sim_watched[SIM_PORTB] = sim_watched[SIM_PORTC] = sim_watched[SIM_PORTD] = 1;
+	for (i = 0; i < SIM_TRACE_TUBES; i++)
+		trace_tube[i] = trace_decode(i);
+	if (!vcd)
+		return;
+
+	if (!(sim_vcd = fopen(vcd, "w"))) {
+		perror(vcd);
+		exit(2);
+	}
+	fprintf(sim_vcd, "$version nixieclock-sim $end\n$timescale 1ns $end\n$scope module nixieclock $end\n");
+	for (i = 0; i < 4; i++)
+		fprintf(sim_vcd, "$var wire 8 %c PORT%c $end\n", '!' + i, 'A' + i);
+	for (i = 0; i < SIM_TRACE_TUBES; i++)
+		fprintf(sim_vcd, "$var wire 4 %c %s $end\n", '%' + i, sim_tubes[i].name);
+	fprintf(sim_vcd, "$var wire 1 + rcol $end\n$var wire 1 , lcol $end\n$var wire 1 - lit $end\n");
+	fprintf(sim_vcd, "$upscope $end\n$enddefinitions $end\n");
+	vcd_dump(0, 1);
+}
+
+void sim_trace_finish(void) {
+	// Print the summary and close the VCD
+	uint64_t periods = (trace_periods > 1)?trace_periods - 1:0;
+	uint64_t total = trace_writes[0] + trace_writes[1] + trace_writes[2] + trace_writes[3];
+	uint8_t i, code;
+
+	trace_batch_end();
+	if (sim_vcd) {
+		fprintf(sim_vcd, "#%llu\n", (unsigned long long)(sim_now * SIM_TRACE_NS));
+		fclose(sim_vcd);
+	}
+
+	printf("port writes %llu, PORTA %llu PORTB %llu PORTC %llu PORTD %llu\n", (unsigned long long)total,
+		(unsigned long long)trace_writes[0], (unsigned long long)trace_writes[1],
+		(unsigned long long)trace_writes[2], (unsigned long long)trace_writes[3]);
+	if (periods) {
+		printf("%llu PWM periods, writes per period min %u avg %.1f max %u\n", (unsigned long long)periods,
+			period_writes_min, (double)period_writes_total / periods, period_writes_max);
+		printf("tubes lit per period min %.1f avg %.1f max %.1f us\n",
+			(double)period_lit_min * 1e6 / SIM_CYCLES_PER_SECOND,
+			(double)period_lit_total * 1e6 / SIM_CYCLES_PER_SECOND / periods,
+			(double)period_lit_max * 1e6 / SIM_CYCLES_PER_SECOND);
+	}
+	printf("transient codes, shown only between two port writes:\n");
+	for (i = 0; i < SIM_TRACE_TUBES; i++) {
+		printf("  %-9s", sim_tubes[i].name);
+		for (code = 0; code < 16; code++)
+			if (transients[i][code])
+				printf(" %u%s x%llu", code, (code == SIM_TRACE_BLANK)?"(blank)":(code > 9)?"(invalid)":"",
+					(unsigned long long)transients[i][code]);
+		printf("\n");
+	}
+}
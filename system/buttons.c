@@ -21,64 +21,137 @@
 
 #include "../include/buttons.h"
 #include "../include/nixie.h"
+#include "../include/display.h"
+#include "../include/isrstats.h"
+#include "../include/profile.h"
+
+// The masks are 8 bits
+typedef char button_count_check[(BUTTON_COUNT <= 8)?1:-1];
 
 // Button variables
-volatile uint8_t set_button_counter = 0x00;
-volatile uint8_t adv_button_counter = 0x00;
-volatile uint8_t set_button_flag, adv_button_flag;
+volatile uint8_t button_state = 0x00;
 volatile uint8_t set_timer = 0xff;
-volatile uint8_t set_button_holdoff = 0x00;
+
+// Debounce, a two bit counter per button sliced across two bytes
+static uint8_t button_count0 = 0xff, button_count1 = 0xff;
+static uint8_t button_hold = 0;						// Ticks the current combination has been held
+static uint8_t button_repeats = 0;					// Repeats so far, stops counting at full speed
+static uint8_t button_idle = 0;						// Ticks with nothing pressed, Timer0 stops at BUTTON_IDLE_TICKS
+
+// Button event queue, Timer0 produces and the main loop consumes, same as the RTC events
+static button_event_t button_event_queue[BUTTON_EVENT_QUEUE_SIZE];
+static volatile uint8_t button_event_head = 0;		// Next free slot, written by the ISR
+static volatile uint8_t button_event_tail = 0;		// Oldest event, written by the main loop
+
+#define BUTTON_SAMPLE(name, pins, bit) \
+	if (!(pins & (1 << bit))) \
+		sample |= BUTTON_##name;
+
+static void button_event_push(uint8_t type, uint8_t buttons) {
+	uint8_t head = button_event_head;
+	uint8_t next = (head + 1) & (BUTTON_EVENT_QUEUE_SIZE - 1);
+
+	loop_wakeup = TRUE;
+	if (next == button_event_tail)
+		return;									// Full, the main loop is way behind
+	button_event_queue[head].type = type;
+	button_event_queue[head].buttons = buttons;
+	button_event_queue[head].time = display_timestamp();
+	button_event_head = next;
+}
+
+uint8_t button_event_pop(button_event_t *event) {
+	// Copies out the oldest event, FALSE if there is nothing waiting
+	uint8_t tail = button_event_tail;
+
+	if (tail == button_event_head)
+		return FALSE;
+	*event = button_event_queue[tail];
+	PROFILE_LATENCY(PROFILE_BUTTON, event->time);
+	button_event_tail = (tail + 1) & (BUTTON_EVENT_QUEUE_SIZE - 1);
+	return TRUE;
+}
+
+uint8_t button_event_pending(void) {
+	return button_event_head != button_event_tail;
+}
+
+static inline uint8_t button_sample(void) {
+	// Read every button in the table into one mask, pressed is 1
+	uint8_t sample = 0;
+
+	BUTTON_TABLE(BUTTON_SAMPLE)
+	return sample;
+}
 
 // Timer 0 functions (button/event timer)
 ISR (TIMER0_OVF_vect) {
-	// test 'set' button
-	if (!(SET_BUTTON_PORT & (1 << SET_BUTTON_IDX))) {
-		set_button_counter++;
-	} else {
-		set_button_counter = 0x00;
-		set_button_flag = NOT_PRESSED;
-	}
-	
-	// set flags for the button state
-	if (set_button_counter >= CONT_PRESS_TIMEOUT) {
-		set_button_flag = CONTINUED_PRESS;
-		set_button_counter = LONG_PRESS_TIMEOUT + 1;
-	} else if (set_button_counter == LONG_PRESS_TIMEOUT) {
-		set_button_flag = LONG_PRESS;
-	} else if (set_button_counter == SHORT_PRESS_TIMEOUT) {
-		set_button_flag = SHORT_PRESS;
-	}
+	ISR_STATS_BEGIN(ISR_STATS_TIMER0_OVF, (1 << TOV0));
+	uint8_t sample, changed, interval;
+
+	// Count every button that disagrees with button_state, any that agree are reset
+	// A button only flips once it has disagreed for 4 ticks in a row
+	sample = button_sample();
+	changed = button_state ^ sample;
+	button_count0 = ~(button_count0 & changed);
+	button_count1 = button_count0 ^ (button_count1 & changed);
+	changed &= button_count0 & button_count1;
+	button_state ^= changed;
+	if (changed & button_state)
+		button_event_push(BUTTON_PRESS, changed & button_state);
+	if (changed & ~button_state)
+		button_event_push(BUTTON_RELEASE, changed & ~button_state);
 
-	// test 'adv' button
-	if (!(ADV_BUTTON_PORT & (1 << ADV_BUTTON_IDX))) {
-		adv_button_counter++;
-	} else {
-		adv_button_counter = 0x00;
-		adv_button_flag = NOT_PRESSED;
+	// One hold timer for whatever combination is down, pressing or letting go of anything starts it over
+	if ((changed) || (!button_state)) {
+		button_hold = 0;
+		button_repeats = 0;
+	} else if (++button_hold == BUTTON_LONG_TICKS) {
+		button_event_push(BUTTON_LONG, button_state);
+	} else if (button_hold == BUTTON_REPEAT_TICKS) {
+		button_event_push(BUTTON_REPEAT, button_state);
+		// Speed up the longer it's held so big changes don't take forever
+		interval = BUTTON_REPEAT_INTERVAL >> (button_repeats / BUTTON_REPEAT_SPEEDUP);
+		if (interval)
+			button_repeats++;
+		else
+			interval = 1;
+		button_hold = BUTTON_REPEAT_TICKS - interval;
 	}
-	
-	// set flags for the button state
-	if (adv_button_counter >= CONT_PRESS_TIMEOUT) {
-		adv_button_flag = CONTINUED_PRESS;
-		adv_button_counter = LONG_PRESS_TIMEOUT + 1;
-	} else if (adv_button_counter == LONG_PRESS_TIMEOUT) {
-		// long press
-		adv_button_flag = LONG_PRESS;
-	} else if (adv_button_counter == SHORT_PRESS_TIMEOUT) {
-		// short press
-		adv_button_flag = SHORT_PRESS;
-	}	
-}
 
-ISR (TIMER0_COMP_vect) {
-// Nothing to see here
+	// Nothing going on for a while, stop until button_wake() sees a press
+	// Not while setting the time, showing the date or in the menu, quick taps there are too short for button_wake() to catch
+	if ((sample) || (button_state) || (clock_state == SET) || (clock_state == DATE) || (clock_state == MENU))
+		button_idle = 0;
+	else if (++button_idle == BUTTON_IDLE_TICKS)
+		button_poll_stop();
 }
 
-void init_event_timer(void) {
+void button_poll_start(void) {
+	button_idle = 0;
 	TCNT0 = 0x00;
 	TCCR0 = (1 << CS02) | (1 << CS00);			// Timer mode with 1024 prescaler 8MHz / 1024 = 7.8125KHz step / 256 steps = 30.5Hz overflow ~32.7ms
-	//TIMSK |= (1 << TOIE0) | (1 << OCIE0);		// Enable timer1 overflow and compare interrupt
+	TIFR = (1 << TOV0);							// Don't take an overflow left over from before it stopped
 	TIMSK |= (1 << TOIE0);						// Enable timer overflow interrupt
+}
+
+void button_poll_stop(void) {
+	TIMSK &= ~(1 << TOIE0);
+	TCCR0 = 0x00;								// Stop the clock to the timer too
+}
+
+void button_wake(void) {
+	// Called from the RTC ISRs four times a second, starts polling again if something is pressed
+	// INT1 and INT2 are display outputs and the mega16 has no pin change interrupts, so this is the
+	// best we can do, a press has to be held for a quarter second to be sure of being seen
+	if ((TIMSK & (1 << TOIE0)) || (power_failed))
+		return;
+	if (button_sample())
+		button_poll_start();
+}
+
+void init_event_timer(void) {
+	button_poll_start();						// Polls until the buttons have been left alone for a bit
 	sei();   
 }
 
@@ -0,0 +1,73 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "../include/calendar.h"
+
+// Month lengths and the days before each month, for a year that isn't a leap year
+static const uint8_t month_length[12] PROGMEM = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+static const uint16_t month_offset[12] PROGMEM = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+uint8_t calendar_is_leap(uint16_t year) {
+	// Gregorian rule, the epoch is a multiple of 400 so it works on the offset
+	if (year % 4)
+		return 0;
+	if (year % 100)
+		return 1;
+	return !(year % 400);
+}
+
+uint8_t calendar_days_in_month(uint16_t year, uint8_t month) {
+	if (month == 2)
+		return 28 + calendar_is_leap(year);
+	return pgm_read_byte(&month_length[month - 1]);
+}
+
+uint16_t calendar_days(uint16_t year, uint8_t month, uint8_t date) {
+	// Days from 1/1/2000 to the date, the leap days before the year are counted directly
+	uint16_t days = year * 365 + ((year + 3) / 4) - ((year + 99) / 100) + ((year + 399) / 400);
+
+	days += pgm_read_word(&month_offset[month - 1]) + date - 1;
+	if ((month > 2) && calendar_is_leap(year))
+		days++;
+	return days;
+}
+
+uint8_t calendar_day_of_week(uint16_t days) {
+	// Sunday = 0, Monday = 1 ... Saturday = 6
+	return (days + CALENDAR_EPOCH_DAY) % 7;
+}
+
+void calendar_date(uint16_t days, uint16_t *year, uint8_t *month, uint8_t *date) {
+	// Turn a day count back into the date
+	// days / 365 is never more than a year ahead in the range a 16 bit count covers
+	uint16_t y = days / 365;
+	uint8_t m = 12;
+	uint16_t offset;
+
+	if (calendar_days(y, 1, 1) > days)
+		y--;
+	days -= calendar_days(y, 1, 1);
+	while (days < (offset = pgm_read_word(&month_offset[m - 1]) + (((m > 2) && calendar_is_leap(y))?1:0)))
+		m--;
+	*year = y;
+	*month = m;
+	*date = days - offset + 1;
+}
@@ -18,247 +18,270 @@
 
 #include "../include/display.h"
 #include "../include/nixie.h"
+#include "../include/isrstats.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 // Display settings
 volatile uint8_t display_duty_cycle = 0xC0;		// 0x7F = 50%, 0cC0 = 75% 0xF0 = MAX
 
 // Display variables
 volatile uint8_t display_new[3] = { 0x00, };	// 0: Hours 1: Minutes 2: Seconds
-volatile uint8_t display_old[3] = { 0x00, };	// 0: Hours 1: Minutes 2: Seconds
 volatile uint8_t display_colons = 0x00;
 volatile uint8_t display_state;					// 
 volatile uint8_t override_pwm = FALSE;			// Force full brightness
 
+// Frame buffers, the main loop renders into the back buffer and the overflow ISR swaps it to the front
+// at the start of the next period. The ISRs only ever read the front buffer
+static display_buffer_t display_buffer[2];
+static volatile uint8_t display_front = 0;
+static volatile uint8_t display_swap = FALSE;	// The back buffer is ready, swap at the next period
+static volatile uint8_t display_faded = TRUE;	// Fade finished, draw the new digits for the whole period
+static volatile uint8_t display_fade_level;		// Where compare A sits in the period, in duty cycle units
+static volatile uint16_t display_periods;		// PWM periods since power up, extends TCNT1 into a timebase
+static volatile uint8_t display_exercise_digit = DISPLAY_EXERCISE_DONE;	// Digit the startup sweep is on
+static volatile uint8_t display_exercise_left;	// PWM periods until the next digit
+static uint8_t display_exercise_periods;		// PWM periods per digit
+static display_frame_t display_exercise_frame;
+static const display_frame_t display_dark = {	// Every tube blanked, colons off
+	PORTA_STATIC | PORTA_DISPLAY_MASK,
+	PORTB_STATIC | (PORTB_DISPLAY_MASK & ~LCOL_MASK),
+	PORTC_STATIC | PORTC_DISPLAY_MASK,
+	PORTD_STATIC | (PORTD_DISPLAY_MASK & ~RCOL_MASK),
+};
+
+// Digit encoder lookup tables, indexed by the two digit field value 0-99
+// Tens and ones are already shifted onto their port pins so the refresh is just a table read
+#define DIGIT_ROW(e, t)	e(t##0), e(t##1), e(t##2), e(t##3), e(t##4), e(t##5), e(t##6), e(t##7), e(t##8), e(t##9)
+#define DIGIT_TABLE(e)	DIGIT_ROW(e, ), DIGIT_ROW(e, 1), DIGIT_ROW(e, 2), DIGIT_ROW(e, 3), DIGIT_ROW(e, 4), \
+						DIGIT_ROW(e, 5), DIGIT_ROW(e, 6), DIGIT_ROW(e, 7), DIGIT_ROW(e, 8), DIGIT_ROW(e, 9)
+
+#define HOUR_ENTRY(n)	(HOUR_TEN_BCD((n) / 10) | HOUR_ONE_BCD((n) % 10))
+#define MINUTE_ENTRY(n)	{ MIN_TEN_BCD((n) / 10) | MIN_ONE_BCD((n) % 10), MIN_ONE_A_BCD((n) % 10) }
+#define SECOND_ENTRY(n)	{ SEC_TEN_BCD((n) / 10), SEC_ONE_BCD((n) % 10) }
+
+static const uint8_t hour_map[100] PROGMEM = { DIGIT_TABLE(HOUR_ENTRY) };		// PORTA
+static const uint8_t minute_map[100][2] PROGMEM = { DIGIT_TABLE(MINUTE_ENTRY) };	// PORTB, PORTD
+static const uint8_t second_map[100][2] PROGMEM = { DIGIT_TABLE(SECOND_ENTRY) };	// PORTD, PORTC
+
+static inline void display_encode(display_frame_t *frame, uint8_t hour, uint8_t minute, uint8_t second) {
+	frame->porta = PORTA_STATIC | pgm_read_byte(&hour_map[hour]);
+	frame->portb = PORTB_STATIC | pgm_read_byte(&minute_map[minute][0]);
+	frame->portc = PORTC_STATIC | pgm_read_byte(&second_map[second][1]);
+	frame->portd = PORTD_STATIC | pgm_read_byte(&minute_map[minute][1]) | pgm_read_byte(&second_map[second][0]);
+}
+
+static inline void display_exercise_render(uint8_t digit) {
+	// Every tube on the same digit, colons on
+	uint8_t digits = digit * 11;
+
+	display_encode(&display_exercise_frame, digits, digits, digits);
+	display_exercise_frame.portd |= RCOL_MASK & _BV(rcol_pin);
+	display_exercise_frame.portb |= LCOL_MASK & _BV(lcol_pin);
+}
+
+static inline void display_write_frame(const display_frame_t *frame) {
+	PORTA = frame->porta;
+	PORTB = frame->portb;
+	PORTC = frame->portc;
+	PORTD = frame->portd;
+}
+
+ISR (TIMER1_OVF_vect) __attribute__ ((hot));
+ISR (TIMER1_OVF_vect) {
+	ISR_STATS_BEGIN(ISR_STATS_TIMER1_OVF, (1 << TOV1));
+	// Top of the PWM period, the hardware has just loaded the compares written during the last period
+	// Draw the start of this period and work out the compares for the next one
+	display_buffer_t *buffer;
+
+	display_periods++;
+	if (display_exercise_digit < DISPLAY_EXERCISE_DONE) {
+		// Startup sweep, full brightness and the frame buffers wait until it's done
+		if (!display_exercise_left--) {
+			display_exercise_left = display_exercise_periods;
+			if (++display_exercise_digit < DISPLAY_EXERCISE_DONE)
+				display_exercise_render(display_exercise_digit);
+		}
+		if (display_exercise_digit < DISPLAY_EXERCISE_DONE) {
+			display_write_frame(&display_exercise_frame);
+			OCR1B = DISPLAY_PWM_COMPARE(0xF0);
+			return;
+		}
+	}
+	if (display_swap) {
+		// A new frame, swapping here means compare A can't switch to it partway through a period
+		display_swap = FALSE;
+		display_front ^= 1;
+		display_faded = !display_buffer[display_front].fade;
+		display_fade_level = display_duty_cycle;	// display_update() has set compare A to the extreme, it was loaded just now
+	}
+	buffer = &display_buffer[display_front];
+	if (display_faded) {
+		display_write_frame(&buffer->new_digits);
+	} else {
+		if (!(TIMSK & (1 << OCIE1A))) {
+			// Start of a fade, or the power came back partway through one
+			// Compare A matches every period even while it's off, clear the flag or it fires straight away
+			TIFR = (1 << OCF1A);
+			TIMSK |= (1 << OCIE1A);
+		}
+		display_write_frame(&buffer->old_digits);
+		// Step the switch over point toward the start of the period, the new digits grow each period
+		if (display_fade_level > clock_settings.crossfade_step) {
+			display_fade_level -= clock_settings.crossfade_step;
+			OCR1A = DISPLAY_PWM_COMPARE(display_fade_level);
+		} else {
+			display_faded = TRUE;				// compA still fires this period, then turns itself off
+		}
+	}
+
+	if (override_pwm)
+		OCR1B = DISPLAY_PWM_COMPARE(0xF0);		// Force full brightness
+	else
+		OCR1B = DISPLAY_PWM_COMPARE(display_duty_cycle);
+}
+
 ISR (TIMER1_COMPA_vect) __attribute__ ((hot));
 ISR (TIMER1_COMPA_vect) {
+	ISR_STATS_BEGIN(ISR_STATS_TIMER1_COMPA, (1 << OCF1A));
 	// Comparison A switches between the old and new digits to display
-	// At the start of a fade the comparison should happen just before compB, which is set for the duty cycle
-	// it then moves toward 0 in set increments until it reaches the beginning and the end of fade
-	display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-	if (clock_settings.crossfade_enable) {
-		if (OCR1AL - clock_settings.crossfade_step > 0) {
-			OCR1AL -= clock_settings.crossfade_step;
-		} else {
-			// end of a fade cycle, old and new are now the same
-			display_old[0] = display_new[0];
-			display_old[1] = display_new[1];
-			display_old[2] = display_new[2];
-		}
-	} else {
-		// No fade, so the old and new are equal anyway
-		display_old[0] = display_new[0];
-		display_old[1] = display_new[1];
-		display_old[2] = display_new[2];
+	// At the start of a fade the comparison happens at the duty cycle compare
+	// the overflow then moves it toward 0 in set increments until the end of the fade
+	if (display_exercise_digit < DISPLAY_EXERCISE_DONE) {
+		TIMSK &= ~(1 << OCIE1A);				// Fade is on hold until the sweep finishes, the overflow turns it back on
+		return;
 	}
+	display_write_frame(&display_buffer[display_front].new_digits);
+	if (display_faded)
+		TIMSK &= ~(1 << OCIE1A);				// Nothing to switch until the next fade
 }
 
 ISR (TIMER1_COMPB_vect) __attribute__ ((hot));
 ISR (TIMER1_COMPB_vect) {
-	// Compare b is the pwm aspect
-	if (OCR1BL == display_duty_cycle) {
-		// first compare
-		display_blank_digits(0b11111111);
-		OCR1BL = 0xFF;							// set the new compare at 255 for an 'overflow'
-	} else {
-		// treat as an overflow
-		display_set_digits(display_old[0], display_old[1], display_old[2], display_colons);	// draw the old digits
-		if (override_pwm)
-			OCR1BL = 0xF0;						// Force full brightness
-		else
-			OCR1BL = display_duty_cycle;		// reset compare for the display duty cycle
-		TCNT1H = 0x00;
-		TCNT1L = 0x00;							// reset the timer, now it's an overflow
-	}
+	ISR_STATS_BEGIN(ISR_STATS_TIMER1_COMPB, (1 << OCF1B));
+	// Compare b is the pwm aspect, the tubes are dark for the rest of the period
+	display_write_frame(&display_dark);
 }
 
 void init_pwm_timer(void) {
-	TCNT1H = 0x00;								// Set the initial timer value to 0
-	TCNT1L = 0x00;
-	OCR1AH = 0x00;
-	OCR1AL = display_duty_cycle;				// Set compare 1 to the extreme
-	OCR1BH = 0x00; 
-	OCR1BL = display_duty_cycle;				// Set the duty cycle
-	TCCR1A |= 0x00; 							// Normal mode, counter always counts up
+	// Nothing has been rendered yet, keep the tubes dark and the pull-ups on until it is
+	display_buffer[0].new_digits = display_dark;
+	display_buffer[1].new_digits = display_dark;
+
+	TCNT1 = 0x0000;								// Set the initial timer value to 0
+	ICR1 = DISPLAY_PWM_TOP;						// Period
+	OCR1A = DISPLAY_PWM_COMPARE(display_duty_cycle);	// Set compare 1 to the extreme
+	OCR1B = DISPLAY_PWM_COMPARE(display_duty_cycle);	// Set the duty cycle
+	// Fast PWM with ICR1 as TOP, OC1A and OC1B are disconnected so the pins stay display outputs
+	// OCR1A and OCR1B are double buffered by the hardware and only change at the end of a period
+	TCCR1A = (1 << WGM11);
 
 	// Set the prescaler							8MHz CLK I/O
-	//TCCR1B |= (1 << CS10);					// No prescaler		8MHz tick	256 ovf @ 0.032 ms
-	//TCCR1B |= (1 << CS11);					// 8				1MHz		256 ovf @ 0.256 ms
-	//TCCR1B |= (1 << CS11) | (1 << CS10);		// 64				125KHz		256 ovf @ 2.048 ms
-	//TCCR1B |= (1 << CS12) | (1 << CS10);		// 1024				7.8125KHz	256 ovf @ 32.768 ms
-	TCCR1B |= (1 << CS12);						// 256				31.25KHz	256 ovf @ 8.192 ms
+	//TCCR1B |= (1 << CS10);					// No prescaler		8MHz tick	8192 top @ 1.024 ms
+	TCCR1B = (1 << WGM13) | (1 << WGM12) | (1 << CS11);	// 8	1MHz		8192 top @ 8.192 ms
+	//TCCR1B |= (1 << CS11) | (1 << CS10);		// 64				125KHz		8192 top @ 65.536 ms
 												// F0 duty cycle (100%) 120 steps 0.983 second fade @ 0x02 step
 												// C0 duty cycle (75%) 96 steps   0.786 second fade @ 0x02 step
 												// 7F duty cycle (50%) 63 steps   0.516 second fade @ 0x02 step
-	TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);		// Enable interrupts on A and B
+	TIMSK |= DISPLAY_TIMSK;						// Enable interrupts on overflow and B, A waits for a fade
 	sei();										// Enable global interrupts by setting global interrupt enable bit in SREG
 }
 
-void display_blank_digits(uint8_t digits) {
+uint32_t display_timestamp(void) {
+	// Free running Timer1 ticks, wraps about every 9 minutes
+	uint16_t periods, count;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		periods = display_periods;
+		count = TCNT1;
+		if ((TIFR & (1 << TOV1)) && (count < (DISPLAY_PWM_TOP / 2)))
+			periods++;							// Wrapped, but the overflow ISR hasn't run yet
+	}
+	return ((uint32_t)periods * (DISPLAY_PWM_TOP + 1)) + count;
+}
+
+uint32_t display_elapsed(uint32_t since) {
+	// Ticks from a display_timestamp() until now, across the wrap
+	return (display_timestamp() - since) & DISPLAY_TIMESTAMP_MASK;
+}
+
+void display_exercise(uint16_t step_ms) {
+	// Start the startup sweep through every digit, run by the overflow ISR so nothing waits on it
+	display_exercise_periods = ((uint32_t)step_ms * (DISPLAY_TICKS_PER_SECOND / 1000)) / (DISPLAY_PWM_TOP + 1);
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		display_exercise_render(0);
+		display_exercise_left = display_exercise_periods;
+		display_exercise_digit = 0;
+	}
+}
+
+uint8_t display_exercising(void) {
+	return display_exercise_digit < DISPLAY_EXERCISE_DONE;
+}
+
+void display_blank_digits(display_frame_t *frame, uint8_t digits) {
 	// 0-5 are tubes, in order from right to left. IE: 0 = Seconds Ones, 5 = Hours Tens
 	// 6 is right colon, 7 is left colon
+	// A tube blanks when all four of its BCD lines are high
 	if (digits & (1<<0))		// Seconds ones
-		SEC_ONE_PORT |= SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_c) | _BV(sec_ten_b) | _BV(sec_ten_a));
+		frame->portc |= SEC_ONE_MASK;
 	if (digits & (1<<1))		// Seconds tens
-		SEC_TEN_PORT |= SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_c) | _BV(sec_ten_b) | _BV(sec_ten_a));
+		frame->portd |= SEC_TEN_MASK;
 	if (digits & (1<<2)){		// Minutes ones
-		MIN_ONE_PORT |= MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_c) | _BV(min_ten_b));
-		PORTD |= 0x01 & _BV(min_one_a);
+		frame->portb |= MIN_ONE_MASK;
+		frame->portd |= _BV(min_one_a);
 	}
 	if (digits & (1<<3))		// Minutes tens
-		MIN_TEN_PORT |= MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_c) | _BV(min_ten_b) | _BV(min_ten_a));
+		frame->portb |= MIN_TEN_MASK;
 	if (digits & (1<<4))		// Hours ones
-		HOUR_ONE_PORT |= HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_c) | _BV(hour_ten_b) | _BV(hour_ten_a));
+		frame->porta |= HOUR_ONE_MASK;
 	if (digits & (1<<5))		// Hours tens
-		HOUR_TEN_PORT |= HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c) | _BV(hour_ten_b) | _BV(hour_ten_a));
+		frame->porta |= HOUR_TEN_MASK;
 	if (digits & (1<<6))		// Right colon
-		RCOL_PORT &= ~(RCOL_MASK & _BV(rcol_pin));
+		frame->portd &= ~(RCOL_MASK & _BV(rcol_pin));
 	if (digits & (1<<7))		// Left colon
-		LCOL_PORT &= ~(LCOL_MASK & _BV(lcol_pin));
+		frame->portb &= ~(LCOL_MASK & _BV(lcol_pin));
 }
 
-void display_set_digits(uint8_t hour, uint8_t minute, uint8_t second, uint8_t colon) {
-// Do not call this directly, instead allow the PWM ISR to do it!
-// Just set display_new to the proper values
-//  if you want to fade them in, also set OCR1AL = display_duty_cycle
-	switch(second / 10) {			// Seconds Tens
-		case 0: SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_c) | _BV(sec_ten_b) | _BV(sec_ten_a))); break;
-		case 9: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_a)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_c) | _BV(sec_ten_b))); 					break;
-		case 8: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_d)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_c) | _BV(sec_ten_b) | _BV(sec_ten_a))); 	break;
-		case 7: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_c) | _BV(sec_ten_b) | _BV(sec_ten_a)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d))); 									break;
-		case 6: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_c) | _BV(sec_ten_b)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_a))); 					break;
-		case 5: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_c) | _BV(sec_ten_a)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_b))); 					break;
-		case 4: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_c)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_b) | _BV(sec_ten_a)));	break;
-		case 3: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_b) | _BV(sec_ten_a)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_c))); 					break;
-		case 2: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_b)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_c) | _BV(sec_ten_a))); 	break;
-		case 1: SEC_TEN_PORT |=   SEC_TEN_MASK & (_BV(sec_ten_a)); 
-				SEC_TEN_PORT &= ~(SEC_TEN_MASK & (_BV(sec_ten_d) | _BV(sec_ten_c) | _BV(sec_ten_b))); 	break;
-	}
-	switch(second % 10) {			// Seconds Ones
-		case 0: SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_c) | _BV(sec_one_b) | _BV(sec_one_a))); break;
-		case 9:	SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_a)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_c) | _BV(sec_one_b))); break;
-		case 8:	SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_d)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_c) | _BV(sec_one_b) | _BV(sec_one_a))); break;
-		case 7: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_c) | _BV(sec_one_b) | _BV(sec_one_a)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d))); break;
-		case 6: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_c) | _BV(sec_one_b)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_a))); break;
-		case 5:	SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_c) | _BV(sec_one_a)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_b))); break;
-		case 4: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_c)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_b) | _BV(sec_one_a))); break;
-		case 3: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_b) | _BV(sec_one_a)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_c))); break;
-		case 2: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_b)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_c) | _BV(sec_one_a))); break;
-		case 1: SEC_ONE_PORT |=   SEC_ONE_MASK & (_BV(sec_one_a)); 
-				SEC_ONE_PORT &= ~(SEC_ONE_MASK & (_BV(sec_one_d) | _BV(sec_one_c) | _BV(sec_one_b))); break;
-	}
-	switch(minute / 10) {			// Minutes Tens	
-		case 0: MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_c) | _BV(min_ten_b) | _BV(min_ten_a))); break;
-		case 9: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_a)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_c) | _BV(min_ten_b))); break;
-		case 8: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_d)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_c) | _BV(min_ten_b) | _BV(min_ten_a))); break;
-		case 7: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_c) | _BV(min_ten_b) | _BV(min_ten_a)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d))); break;
-		case 6: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_c) | _BV(min_ten_b));
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_a))); break;
-		case 5: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_c) | _BV(min_ten_a));
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_b))); break;
-		case 4: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_c)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_b) | _BV(min_ten_a))); break;
-		case 3: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_b) | _BV(min_ten_a)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_c))); break;
-		case 2: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_b));
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_c) | _BV(min_ten_a))); break;
-		case 1: MIN_TEN_PORT |=   MIN_TEN_MASK & (_BV(min_ten_a)); 
-				MIN_TEN_PORT &= ~(MIN_TEN_MASK & (_BV(min_ten_d) | _BV(min_ten_c) | _BV(min_ten_b))); break;
-	}
-	switch(minute % 10) {			// Minutes Ones ****** 'A' PIN IS ON ANOTHER REGISTER, FUCK!
-		case 0: MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_c) | _BV(min_one_b))); PORTD &= ~(0x01 &  _BV(min_one_a)); break;
-		case 9: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_d));  				 PORTD |=   0x01 & (_BV(min_one_a));
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_c) | _BV(min_one_b))); break;
-		case 8: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_d)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_c) | _BV(min_one_b))); PORTD &= ~(0x01 &  _BV(min_one_a)); break;
-		case 7: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_c) | _BV(min_one_b));  PORTD |=   0x01 & (_BV(min_one_a)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d))); break;
-		case 6: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_c) | _BV(min_one_b));
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d))); 				 PORTD &= ~(0x01 &  _BV(min_one_a)); break;
-		case 5: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_c));  				 PORTD |=   0x01 & (_BV(min_one_a)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_b))); break;
-		case 4: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_c)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_b))); PORTD &= ~(0x01 &  _BV(min_one_a)); break;
-		case 3: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_b));  				 PORTD |=   0x01 & (_BV(min_one_a)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_c))); break;
-		case 2: MIN_ONE_PORT |=   MIN_ONE_MASK & (_BV(min_one_b)); 
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_c))); PORTD &= ~(0x01 &  _BV(min_one_a)); break;
-		case 1:																		 PORTD |=   0x01 & (_BV(min_one_a));	
-				MIN_ONE_PORT &= ~(MIN_ONE_MASK & (_BV(min_one_d) | _BV(min_one_c) | _BV(min_one_b))); break;
-	}	
-	if ((clock_settings.leading_zero_blank) && (clock_state==NORMAL) && (hour / 10 == 0)) {
-		HOUR_TEN_PORT |= HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c) | _BV(hour_ten_b) | _BV(hour_ten_a));
-	} else {
-		switch(hour / 10) {				// Hour tens
-			case 0: HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c) | _BV(hour_ten_b) | _BV(hour_ten_a))); break;
-			case 9: HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_a)); 
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_c) | _BV(hour_ten_b))); break;
-			case 8:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_d));	
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_c) | _BV(hour_ten_b) | _BV(hour_ten_a))); break;
-			case 7:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_c) | _BV(hour_ten_b) | _BV(hour_ten_a)); 
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d))); break;
-			case 6:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_c) | _BV(hour_ten_b)); 
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_a))); break;
-			case 5:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_c) | _BV(hour_ten_a)); 
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_b)));break;
-			case 4:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_c));	
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_b) | _BV(hour_ten_a))); break;
-			case 3:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_b) | _BV(hour_ten_a));
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c))); break;
-			case 2:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_b));	
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c) | _BV(hour_ten_a)));break;
-			case 1:	HOUR_TEN_PORT |=   HOUR_TEN_MASK & (_BV(hour_ten_a));
-					HOUR_TEN_PORT &= ~(HOUR_TEN_MASK & (_BV(hour_ten_d) | _BV(hour_ten_c) | _BV(hour_ten_b)));break;
-		}
-	}
-	switch(hour % 10) {			// Hour ones
-		case 0: HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_c) | _BV(hour_one_b) | _BV(hour_one_a))); break;
-		case 9: HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_a)); 
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_c) | _BV(hour_one_b))); break;
-		case 8: HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_d));	
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_c) | _BV(hour_one_b) | _BV(hour_one_a))); break;
-		case 7: HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_c) | _BV(hour_one_b) | _BV(hour_one_a)); 
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d))); break;
-		case 6: HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_c) | _BV(hour_one_b)); 
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_a))); break;
-		case 5: HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_c) | _BV(hour_one_a)); 
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_b))); break;
-		case 4:	HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_c));	
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_b) | _BV(hour_one_a))); break;
-		case 3:	HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_b) | _BV(hour_one_a)); 
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_c))); break;
-		case 2:	HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_b));	
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_c) | _BV(hour_one_a))); break;
-		case 1:	HOUR_ONE_PORT |=   HOUR_ONE_MASK & (_BV(hour_one_a));	
-				HOUR_ONE_PORT &= ~(HOUR_ONE_MASK & (_BV(hour_one_d) | _BV(hour_one_c) | _BV(hour_one_b))); break;
-	}
+void display_set_digits(display_frame_t *frame, uint8_t hour, uint8_t minute, uint8_t second, uint8_t colon) {
+// Encode the digits into a frame, nothing is written to the ports here
+	display_encode(frame, hour, minute, second);
+
+	if ((clock_settings.leading_zero_blank) && (clock_state==NORMAL) && (hour < 10))
+		frame->porta |= HOUR_TEN_MASK;			// All ones is not a valid BCD code, the tube goes dark
+
 	// Colons
 	if (colon & (1<<0))
-		RCOL_PORT |= RCOL_MASK & _BV(rcol_pin);
-	else
-		RCOL_PORT &= ~(RCOL_MASK & _BV(rcol_pin));
+		frame->portd |= RCOL_MASK & _BV(rcol_pin);
 	if (colon & (1<<1))
-		LCOL_PORT |= LCOL_MASK & _BV(lcol_pin);
-	else
-		LCOL_PORT &= ~(LCOL_MASK & _BV(lcol_pin));
-}
\ No newline at end of file
+		frame->portb |= LCOL_MASK & _BV(lcol_pin);
+}
+
+void display_update(uint8_t blank) {
+// Render display_new and display_colons, with the tubes in blank turned off, and hand it to the ISRs
+// Nothing happens if the frame is the same as what is already showing
+	display_buffer_t *front, *back;
+
+	display_swap = FALSE;						// Replaces one still waiting, and keeps the ISR off the back buffer
+	front = &display_buffer[display_front];
+	back = &display_buffer[display_front ^ 1];
+	display_set_digits(&back->new_digits, display_new[0], display_new[1], display_new[2], display_colons);
+	display_blank_digits(&back->new_digits, blank);
+	if ((back->new_digits.porta == front->new_digits.porta) &&
+		(back->new_digits.portb == front->new_digits.portb) &&
+		(back->new_digits.portc == front->new_digits.portc) &&
+		(back->new_digits.portd == front->new_digits.portd))
+		return;
+
+	// Nothing to fade from while the sweep is on, the front buffer is still dark until it finishes
+	back->fade = (clock_settings.crossfade_enable) && (!override_pwm) && (!display_exercising());
+	back->old_digits = (back->fade)?front->new_digits:back->new_digits;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (back->fade)
+			OCR1A = DISPLAY_PWM_COMPARE(display_duty_cycle);	// Start of the fade, loaded at the next period
+		display_swap = TRUE;
+	}
+}
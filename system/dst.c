@@ -0,0 +1,76 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+
+#include "../include/dst.h"
+#include "../include/rtc.h"
+#include "../include/nixie.h"
+#include "../include/calendar.h"
+
+// Next daylight saving time change, worked out ahead of time so checking for it is a single compare
+uint32_t dst_next = DST_NEVER;
+static uint8_t dst_forward;					// Spring ahead, otherwise fall back
+
+static uint32_t dst_instant(uint16_t year, uint8_t month, uint8_t day, uint8_t week, uint8_t hour) {
+	// rtc_seconds at the top of the hour on the nth day of the week in the month
+	uint16_t first = calendar_days(year, month, 1);
+	uint8_t date;
+
+	date = 1 + (7 + day - calendar_day_of_week(first)) % 7;	// First one in the month
+	date += (week - 1) * 7;
+	while (date > calendar_days_in_month(year, month))
+		date -= 7;										// Only the last week can run off the end
+	return (first + date - 1) * 86400UL + hour * 3600UL;
+}
+
+void dst_schedule(uint32_t after) {
+	// Find the first transition after the given time, this year or next
+	// clock has to be showing a time in the same year
+	uint16_t year;
+	uint32_t when;
+
+	dst_next = DST_NEVER;
+	if (!clock_settings.daylight_saving_enable)
+		return;
+
+	for (year = clock.year; year <= clock.year + 1; year++) {
+		when = dst_instant(year, clock_settings.spring_ahead_month, clock_settings.spring_ahead_day,
+							clock_settings.spring_ahead_week, clock_settings.spring_ahead_hour);
+		if ((when > after) && (when < dst_next)) {
+			dst_next = when;
+			dst_forward = TRUE;
+		}
+		when = dst_instant(year, clock_settings.fall_back_month, clock_settings.fall_back_day,
+							clock_settings.fall_back_week, clock_settings.fall_back_hour);
+		if ((when > after) && (when < dst_next)) {
+			dst_next = when;
+			dst_forward = FALSE;
+		}
+	}
+}
+
+void dst_transition(void) {
+	// The clock has reached dst_next, move it and line up the next one
+	// Scheduling from the transition and not the new time keeps the repeated hour after falling back
+	// from matching again
+	uint32_t when = dst_next;
+
+	rtc_adjust((dst_forward)?3600L:-3600L);
+	dst_schedule(when);
+}
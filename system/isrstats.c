@@ -0,0 +1,72 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+#include <avr/io.h>
+#include <util/atomic.h>
+
+#include "../include/nixie.h"
+#include "../include/display.h"
+#include "../include/isrstats.h"
+
+#ifdef ISR_STATS
+
+isr_stats_t isr_stats[ISR_STATS_VECTORS];
+static uint8_t isr_stats_page = 0;
+
+static uint16_t isr_stats_cycles(uint32_t ticks) {
+	// Timer1 ticks to CPU cycles, as much as four tubes can show
+	ticks *= F_CPU / DISPLAY_TICKS_PER_SECOND;
+	return (ticks > 9999)?9999:ticks;
+}
+
+void isr_stats_read(uint8_t field_values[2], uint8_t vector) {
+	// Fill in the menu fields for one vector, the colons show which page
+	isr_stats_t stats;
+	uint16_t value = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		stats = isr_stats[vector];
+	}
+
+	display_colons = isr_stats_page;
+	switch (isr_stats_page) {
+		case 0:
+			value = isr_stats_cycles(stats.max);
+			break;
+		case 1:
+			if (stats.count)
+				value = isr_stats_cycles(stats.sum / stats.count);
+			break;
+		case 2:
+			value = isr_stats_cycles(stats.min);
+			break;
+		case 3:
+			value = (stats.overruns > 9999)?9999:stats.overruns;
+			break;
+	}
+	field_values[0] = value / 100;
+	field_values[1] = value % 100;
+}
+
+void isr_stats_next_page(void) {
+	if (++isr_stats_page == ISR_STATS_PAGES)
+		isr_stats_page = 0;
+}
+
+#endif // ISR_STATS
@@ -23,36 +23,43 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
-#include <avr/eeprom.h>
-#include <util/delay.h>
 
 #include "../include/rtc.h"
 #include "../include/nixie.h"
 #include "../include/display.h"
 #include "../include/buttons.h"
+#include "../include/scheduler.h"
+#include "../include/dst.h"
+#include "../include/calendar.h"
+#include "../include/settings.h"
+#include "../include/isrstats.h"
+#include "../include/profile.h"
 
 // Settings/config
 volatile clock_settings_t clock_settings;
-volatile EEMEM clock_settings_t clock_settings_eeprom;
 volatile uint8_t menu_option;
 
-// Software time correction stuff
-volatile uint32_t correction_counter;			
-volatile uint32_t correction_value;
-volatile int8_t correction_flag;
-
 // Fancy up/down option for some menu settings
 volatile uint8_t inc_dec;
 volatile uint8_t swap;
 
-volatile uint8_t just_woke_up = 1;
+// Main loop sleep and load tracking
+volatile uint8_t loop_wakeup = FALSE;
+volatile uint8_t power_failed = FALSE;
+volatile uint32_t loop_awake_cycles;
+static uint32_t awake_start, awake_time;			// In Timer1 ticks
 
 ISR(INT0_vect) {
 // Power Fail pin (PD2) is configured for external interrupt on rising and falling edges.
 // Check for power failure and sleep if needed or wake up if needed
-	if (!(PF_PORT && (1 << PF_PIN))) {
-		// disable interrupts for the the buttons, since the power on confuses them
-		TIMSK &= ~(1 << TOIE0);
+	loop_wakeup = TRUE;
+	if (!(PF_PINS & (1 << PF_PIN))) {
+		// stop polling the buttons, since the power on confuses them
+		button_poll_stop();
+		
+		// disable interrupts for the display, they would drive the ports again
+		// Compare A as well if a fade was going, the overflow turns it back on
+		TIMSK &= ~(DISPLAY_TIMSK | (1 << OCIE1A));
 		
 		// Set the ports low, save power
 		PORTA = 0x00;
@@ -60,36 +67,29 @@ ISR(INT0_vect) {
 		PORTC = (1<<PC6);
 		PORTD = 0x00;
 		
-		// set sleep mode
-		set_sleep_mode (SLEEP_MODE_PWR_SAVE);
-		// go to sleep
-		sleep_enable();
-	} else if (PF_PORT && (1 << PF_PIN)) {
+		// Get the time into EEPROM in case the supercap runs flat
+		snapshot_write();
+		
+		// the main loop sleeps in power save from now on
+		power_failed = TRUE;
+	} else {
 		// wake up!
-		sleep_disable ();
+		power_failed = FALSE;
 		
-		// Update the display digits
-		display_set_digits(clock.hour, clock.minute, clock.second, display_colons);
 		clock_state = NORMAL;
 		display_state = NORMAL;		
 		
-		// Set the initial timer value to 0
-		TCNT1H = 0x00;
-		TCNT1L = 0x00;
-		
-		// Re-enable interrupts for the display
-		TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);			
+		// Re-enable interrupts for the display, the timer kept its period
+		TIMSK |= DISPLAY_TIMSK;
 		
-		// Enable button timer interrupt
-		TIMSK |= (1 << TOIE0);
+		// Poll the buttons again, it stops by itself if they aren't touched
+		button_poll_start();
 		
-		clock_settings = ReadEEPROM();
+		// The settings in RAM are still good, the supercap kept them
 		set_display_duty_cycle(clock_settings.brightness);
 		
-		// Calculate a new software time correction value
-		correction_value = 60480000 / (uint32_t)((clock_settings.software_time_correction > 0)?
-										clock_settings.software_time_correction:
-										clock_settings.software_time_correction * -1);	
+		// Hand the software time correction to the RTC
+		rtc_set_correction(clock_settings.software_time_correction);
 	}
 }
 
@@ -117,249 +117,108 @@ void init_pins(void) {
 
 int main(void) {
 	uint8_t field_values[2] = {0x00, };
-	correction_flag = 0;
-	correction_counter = 0x0000;			
-	correction_value = 0;		
+	uint8_t warm_start;
+	uint8_t pressed, held, repeated;
+	button_event_t button;
+	
+	// Anything but a power on reset leaves RAM alone, if the time is still there skip the long boot
+	warm_start = (!(MCUCSR & (1 << PORF))) && rtc_resume();
+	MCUCSR = 0;
+	PROFILE_INIT();
 	
 	// Clock is initially in the NORMAL state
 	clock_state = NORMAL;
 	
-	// Load settings from EEPROM
-	clock_settings = ReadEEPROM();
+	// Setup pins, power fail sense and the button pull-ups
+	init_pins();
+	
+	// Start display update timer, the tubes stay dark until something is rendered
+	// It is also the timebase for the boot latency in the profile, which counts from here and not reset,
+	// only the reset cause and the pins come before it
+	init_pwm_timer();
+	
+	// Get the time going before anything else
+	init_rtc();				// RTC
+	if (warm_start)
+		snapshot_init();	// The time is still good, just line up the next snapshot after the old ones
+	else
+		snapshot_restore();	// Carry on from the time saved when the power went out, if there is one
+	PROFILE_BOOT(display_timestamp());
+	init_event_timer();		// Button timer
 	
-	// Sanity check the settings to see if EEPROM was never initialized
-	if (clock_settings.magic_number != MAGIC_NUMBER) {
+	// Load settings from EEPROM, if it was never initialized use the defaults
+	if (!settings_load())
 		WriteDefaultSettings();
-		clock_settings = ReadEEPROM();
-	}
 
 	// Update the duty cycle
 	set_display_duty_cycle(clock_settings.brightness);
 	
-	// Setup pins
-	init_pins();
+	// Software time correction
+	rtc_set_correction(clock_settings.software_time_correction);
 	
-	// Start display update timer
-	init_pwm_timer();	
+	// Daylight saving time
+	dst_schedule(rtc_now());
 	
-	// Exercise the display
-	exercise_display(250);
-
-	// Initialize the services	
-	init_rtc();				// RTC
-	init_event_timer();		// Button timer
+	// Exercise the display, the ISRs run it while the clock carries on
+	// Not worth doing after a warm start
+	if (!warm_start)
+		display_exercise(250);
+	update_display();
+	
+	// Periodic tasks, run from the RTC ticks in this order
+	scheduler_add(dst_task, TICKS_PER_SECOND, HALF_SECOND);
+	scheduler_add(colon_task, TICKS_PER_SECOND / 2, 0);
+	scheduler_add(time_task, TICKS_PER_SECOND, 0);
+	scheduler_add(date_flash_task, TICKS_PER_SECOND, 0);
+	scheduler_add(refresh_task, 1, 0);
+	scheduler_add(menu_timeout_task, TICKS_PER_SECOND, TQRT_SECOND);
+	scheduler_add(load_task, TICKS_PER_SECOND, 0);
+	scheduler_add(snapshot_task, TICKS_PER_SECOND, 0);
+	awake_start = display_timestamp();
 	
 	while (1) {		
-		// Handle flags from the RTC
-		switch (sentinal) {
-			case QRTR_SECOND:								// Stuff to do at the quarter second mark
-				//Unblank the blinky bits in set mode
-				if (clock_state == SET)
-					display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-				
-				if (set_button_holdoff == 0x01)
-					set_button_holdoff++;
-				else if (set_button_holdoff >= 0x02)
-					set_button_holdoff = 0;
-				
-				sentinal = CLEAR;
-				break;
-			case HALF_SECOND:								// Stuff to do at the half second mark
-				// Take care of daylight saving time
-				if ((clock_settings.daylight_saving_enable) && (!dst_handled)){
-					if ((clock.second == 0) &&
-					    (clock.month == clock_settings.spring_ahead_month) && 
-					    (clock.day == clock_settings.spring_ahead_day) && 
-					    (clock.hour == clock_settings.spring_ahead_hour) &&
-					    (clock.date <= clock_settings.spring_ahead_week * 7) &&
-						(clock.date > (clock_settings.spring_ahead_week - 1) * 7)) {
-							clock.hour += 1;
-							dst_handled = 1;
-					}
-					if ((clock.second == 0) &&
-					    (clock.month == clock_settings.fall_back_month) && 
-					    (clock.day == clock_settings.fall_back_day) && 
-					    (clock.hour == clock_settings.fall_back_hour) &&
-					    (clock.date <= clock_settings.fall_back_week * 7) &&
-						(clock.date > (clock_settings.fall_back_week - 1) * 7)) {
-							clock.hour -= 1;
-							dst_handled = 1;
-					}					
-				}				
-				
-				// In SET mode, blink the bank of digits we're setting
-				if (clock_state == SET) {
-					switch (set_mode) {
-						case YEAR_SET:
-						case SEC_SET:
-							display_blank_digits(0b00000011);
-							break;
-						case DATE_SET:
-						case MIN_SET:
-							display_blank_digits(0b00001100);
-							break;
-						case MONTH_SET:
-						case HOUR_SET:
-							display_blank_digits(0b00110000);
-							break;
-					}
-				}	
-				
-				if (clock_state == NORMAL) {
-					// Display or blink the colons depending on mode
-					if (clock_settings.blinking_colons == 1) {	// Mode 1: Blink @ .5Hz
-						display_colons = 0x03;
-					} else if (clock_settings.blinking_colons == 4) {
-						display_colons = 0x03;
-					}
-				}
-				
-				// Handle the button delay to make them easier to use
-				if (set_button_holdoff == 0x01)
-					set_button_holdoff++;
-				else if (set_button_holdoff >= 0x02)
-					set_button_holdoff = 0;
-				
-				sentinal = CLEAR;
-				break;
-			case TQRT_SECOND:					//Stuff to do every three quarter of a second mark
-				if ((clock_state == SET) || (clock_state == MENU)){
-					// Increment the set/menu mode timeout timer
-					if (set_timer != 255)
-						set_timer++;
-				}
-				
-				// Unblank the blinky bits in set mode
-				if (clock_state == SET)
-					display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-				
-				// Handle the button delay to make them easier to use
-				if (set_button_holdoff == 0x01)
-					set_button_holdoff++;
-				else if (set_button_holdoff >= 0x02)
-					set_button_holdoff = 0;
-				
-				sentinal = CLEAR;
-				break;
-			case SECOND:						// Stuff to do at the start of every second
-				/*	
-				Software Time Correction
-				Start a counter (uint32_t) that counts the seconds until we need to add or subtract a second.
-				Update this counter and check it in the main loop. Set an int8_t either 1 or -1 each time you're ready to 
-				make the change. On the second transition in the RTC counter check for non zero on this and change accordingly
-				
-				One week is 604,800. Divide 604800 by the correction value to get the counter overflow value
-					Ex: If we need to add 1.945 seconds a week, that's one second every 311,752 seconds
-				*/
-				//correction_flag = 0;	
-				if (++correction_counter > correction_value) {
-					correction_counter = 0;
-					if (clock_settings.software_time_correction < 0)
-						correction_flag = -1;
-					else	
-						correction_flag = 1;
-				}			
-			
-				// Update the global display registers
-				if (display_state == NORMAL) {
-					// Display or blink the colons depending on mode
-					if (clock_settings.blinking_colons == 1) {			// Mode 1: .5hz
-						display_colons = 0x00;
-					} else if (clock_settings.blinking_colons == 2) { 	// Mode 2: 1 hz
-						if (display_colons == 0x00) {
-							display_colons = 0x03;
-						} else {
-							display_colons = 0x00;
-						}
-					} else if (clock_settings.blinking_colons == 3) {	// Mode 3: AM/PM
-						if (clock.hour > 11) {
-							display_colons == 0x03;
-						} else {
-							display_colons == 0x00;
-						}
-					} else if (clock_settings.blinking_colons == 4) {	// Mode 4: On
-						display_colons = 0x03;
-					}
-					
-					// Display the time or date depending on mode
-					display_new[1] = clock.minute;
-					display_new[2] = clock.second;
-					// Handle 12/24 hour mode
-					if (!clock_settings.clock_display_24hr) {
-						display_new[0] = clock.hour % 12;
-						if (display_new[0] == 0)
-							display_new[0] = 12;
-					} else {
-						display_new[0] = clock.hour;
-					}
-					
-				// Display is in date mode, display that instead
-				} else if (display_state == DATE) {
-					display_new[0] = clock.month;
-					display_new[1] = clock.date;
-					display_new[2] = clock.year;
-				}
-
-				// If we're in SET mode, blink the bank of digits we're setting
-				if (clock_state == SET) {
-					switch (set_mode) {				
-						case YEAR_SET:
-						case SEC_SET:
-							display_blank_digits(0b00000011);
-							break;
-						case DATE_SET:
-						case MIN_SET:
-							display_blank_digits(0b00001100);
-							break;
-						case MONTH_SET:
-						case HOUR_SET:
-							display_blank_digits(0b00110000);
-							break;
-					}
-				}	
-				
-				// Periodically display the date if enabled
-				if ((clock_settings.display_date) &&
-					(clock_state == NORMAL) &&
-					(clock.second >= clock_settings.display_date_at_seconds) &&
-					(clock.second < clock_settings.display_date_at_seconds + clock_settings.display_date_duration)) {
-					display_new[0] = clock.month;
-					display_new[1] = clock.date;
-					display_new[2] = clock.year;		
-					if (clock_settings.blinking_colons_during_date == 1)
-						display_colons = 0x03;
-					else if (clock_settings.blinking_colons_during_date == 0)
-						display_colons = 0x00;
-				}
-				
-				// start a fade and set compa to the extreme
-				OCR1AL = display_duty_cycle;
-				
-				// Do some stuff to slow down button response and make it more usable
-				if (set_button_holdoff == 0x01)
-					set_button_holdoff++;
-				else if (set_button_holdoff >= 0x02)
-					set_button_holdoff = 0;
-				
-				sentinal = CLEAR;
-				break;
+		// Sleep until an interrupt has something for us
+		wait_for_event();
+		rtc_sync();
+		
+		// Handle events from the RTC, one per pass so the buttons get looked at in between
+		scheduler_dispatch(rtc_event_pop());
+		
+		// And one button event, anything the mode doesn't want is dropped
+		pressed = held = repeated = 0;
+		if (button_event_pop(&button)) {
+			switch (button.type) {
+				case BUTTON_PRESS:
+					pressed = button.buttons;
+					break;
+				case BUTTON_LONG:
+					held = button.buttons;
+					break;
+				case BUTTON_REPEAT:
+					// A repeat we were too busy for would only overshoot once the button is let go
+					if (display_elapsed(button.time) < BUTTON_REPEAT_STALE)
+						repeated = button.buttons;
+					break;
+			}
 		}
+		
 		// do the business, handle various modes of the clock
 		switch (clock_state) {
 			case NORMAL:
 				override_pwm = FALSE;							// Don't force disable PWM
 				clock_settings.crossfade_enable = TRUE;			// Enable crossfade
 				
-				// Handle Cathode Poisoning Prevention routine here
-				if (clock_settings.cathode_poison_prevention_enabled) {
-					if ((clock.hour >= clock_settings.cathode_poison_start_hour) && 
-					(clock.hour < clock_settings.cathode_poison_start_hour + clock_settings.cathode_poisoning_duration)) {
-						cathode_poison_routine();
-					}
+				// Start the Cathode Poisoning Prevention service here, unless the buttons are in use
+				// or we're on the supercap, cathode_poison_routine() would only drop straight back out
+				if ((cathode_poison_due()) && (!button_state) && (!power_failed)) {
+					override_pwm = TRUE;						// Demand full brightness and no crossfade
+					clock_state = CP_SERVICE;
+					display_state = CP_SERVICE;
+					break;
 				}
 				
 				// Has the user done anything with the buttons?
-				if ((set_button_flag == LONG_PRESS) && (adv_button_flag == LONG_PRESS)) {
+				if (held == (BUTTON_SET | BUTTON_ADV)) {
 				// Entered setup menu
 					override_pwm = TRUE;						// Force full brightness
 					clock_settings.crossfade_enable = FALSE;	// Turn off the fade
@@ -367,9 +226,7 @@ int main(void) {
 					display_state = MENU;						// We're in the menu, let the display stuff know
 					menu_option = 1;							// Start back at option one in the menu
 					set_timer = 0;								// Start the timeout timer
-					TIMSK &= ~((1 << OCIE1A) | (1 << OCIE1B));	// disable interrupts for the display
-					set_button_holdoff = 0x01;
-				} else if ((set_button_flag == LONG_PRESS) && (ADV_BUTTON_PORT & (1 << ADV_BUTTON_IDX))){
+				} else if (held == BUTTON_SET) {
 				// Entered Set mode
 					override_pwm = TRUE;						// Force full brightness
 					clock_settings.crossfade_enable = FALSE;	// Disable crossfade
@@ -377,10 +234,8 @@ int main(void) {
 					display_state = NORMAL;						// Tell the display to show the time
 					set_mode = SEC_SET;							// Set the initial field to update
 					set_timer = 0;								// Start the timeout timer
-					TIMSK &= ~((1 << OCIE1A) | (1 << OCIE1B));	// disable interrupts for the display
-					set_button_holdoff = 0x01;
-					display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-				} else if ((adv_button_flag == LONG_PRESS) && (SET_BUTTON_PORT & (1 << SET_BUTTON_IDX))) {
+					display_update(0);
+				} else if (held == BUTTON_ADV) {
 					// Set to 'Date Only' mode
 					display_state = DATE;						// Tell the display to show the date
 					clock_state = DATE;
@@ -388,57 +243,39 @@ int main(void) {
 				break;
 			case SET:	
 				// Has the user done anything with the buttons?
-				if ((set_button_flag == SHORT_PRESS) && (!set_button_holdoff)) {
+				if (pressed & BUTTON_SET) {
 				// Cycle through the settable fields and blink whatver one we're in
-					set_button_holdoff = 0x01;					// set the holdoff
 					set_timer = 0;								// Clear the menu timeout timer
 					switch (set_mode) {							// Cycle through the fields
 						case SEC_SET:
 							set_mode = MIN_SET;	
 							display_state = NORMAL;
-							display_blank_digits(0b00000011);
 							break;
 						case MIN_SET:
 							set_mode = HOUR_SET;
 							display_state = NORMAL;
-							display_blank_digits(0b00001100);
 							break;
 						case HOUR_SET:
 							set_mode = MONTH_SET;
 							display_state = DATE;
-							display_blank_digits(0b00110000);
 							break;
 						case MONTH_SET:
 							set_mode = DATE_SET;
 							display_state = DATE;
-							display_blank_digits(0b00110000);
 							break;
 						case DATE_SET:
 							set_mode = YEAR_SET;
 							display_state = DATE;
-							display_blank_digits(0b00001100);
 							break;
 						case YEAR_SET:
 							set_mode = SEC_SET;
 							display_state = NORMAL;
-							display_blank_digits(0b00000011);
 							break;
 					}
 					update_display();				// Update the display since we just entered Set mode
-				}else if (adv_button_flag == SHORT_PRESS) {	
-				// Increment the field
-					set_timer = 0;
-					//adv_button_counter = 0;
-					adv_button_flag = NOT_PRESSED;
-					increment_time_date(set_mode);	// increment whatever field we're in
-					update_display();	// Update the display since we just changed a value and dont want to wait for the next interrupt
-				}
-				else if ((adv_button_flag == CONTINUED_PRESS)){// && (sentinal = HALF_SECOND)) {	
-				// Handle repeated increments
-					sentinal = CLEAR;
+				}else if ((pressed & BUTTON_ADV) || (repeated == BUTTON_ADV)) {	
+				// Increment the field, holding the button repeats
 					set_timer = 0;
-					adv_button_counter = CONT_PRESS_TIMEOUT - 5;
-					adv_button_flag = NOT_PRESSED;					
 					increment_time_date(set_mode);	// increment whatever field we're in
 					update_display();				// Update the display since we just changed a value and dont want to wait for the next interrupt
 				}
@@ -452,80 +289,62 @@ int main(void) {
 				
 				// Have we timed out in this mode?
 				if (set_timer > 10) {
-					display_set_digits(display_old[0], display_old[1], display_old[2], display_colons);
-					TCNT1H = 0x00;									// Set the initial timer value to 0
-					TCNT1L = 0x00;
-					TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);			// Re-enable interrupts for the display
 					clock_state = NORMAL;
 					display_state = NORMAL;
 					set_timer = 255;
+					update_display();
 				}
 				break;
 			case MENU:
-				TIMSK &= ~((1 << OCIE1A) | (1 << OCIE1B));		// disable interrupts for the display, force disable PWM
-				
 				// Draw the menu on the display
 				display_colons = 0x00;
 				read_menu_setting(field_values, menu_option);	// Setup the field_values array with the values for this menu option
 				display_new[0] = menu_option;
 				display_new[1] = field_values[0];
 				display_new[2] = field_values[1];
-				display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
 
 				// Blank out the unused digits
 				if (field_values[0] == 0)
-					display_blank_digits(0b00001100);
+					display_update(0b00001100);
 				else if ((field_values[0] / 10) == 0)
-					display_blank_digits(0b00001000);
+					display_update(0b00001000);
+				else
+					display_update(0);
 			
 				// Handle set button press, cycle through the menu options
-				if ((set_button_flag == SHORT_PRESS) && (!set_button_holdoff)) {
-					// set the holdoff
+				if (pressed & BUTTON_SET) {
 					set_timer = 0;							// Clear the menu timeout timer
-					set_button_holdoff = 0x01;
 					swap = 1;								// clear swap, we aren't holding cont press
 					// Cycle through the options to set
-					if (++menu_option > MENU_OPTION_COUNT)
+					if (++menu_option > MENU_OPTION_COUNT + ISR_STATS_MENU_OPTIONS)
 						menu_option = 1;
-				}else if (adv_button_flag == SHORT_PRESS) {	
+				}else if (pressed & BUTTON_ADV) {	
 				// Increment the field
 					set_timer = 0;
-					adv_button_counter = 0;
-					adv_button_flag = NOT_PRESSED;
 					increment_menu_setting(menu_option, 0);
 				} 
-				else if ((adv_button_flag == CONTINUED_PRESS) && (sentinal = HALF_SECOND)) {
+				else if (repeated == BUTTON_ADV) {
 				// Handle repeated increments
-					sentinal = CLEAR;
 					set_timer = 0;
-					adv_button_counter = CONT_PRESS_TIMEOUT - 5;
-					adv_button_flag = NOT_PRESSED;
 					increment_menu_setting(menu_option, 1);
 				}
 				
 				// Have we timed out in this mode?
 				if (set_timer > 10) {
-					// Commit the changes to EEPROM
-					UpdateSettings(clock_settings);
+					// Commit the changes to EEPROM, it carries on in the background
+					settings_commit();
 					//	Set brightness
 					set_display_duty_cycle(clock_settings.brightness);
-					// Calculate a new software time correction value
-					correction_value = 60480000 / (uint32_t)((clock_settings.software_time_correction > 0)?
-													clock_settings.software_time_correction:
-													clock_settings.software_time_correction * -1);
-					// Update the display digits
-					display_set_digits(display_old[0], display_old[1], display_old[2], display_colons);
-					
-					// Set the initial timer value to 0
-					TCNT1H = 0x00;
-					TCNT1L = 0x00;
-					// Re-enable interrupts for the display
-					TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);
+					// Hand the software time correction to the RTC
+					rtc_set_correction(clock_settings.software_time_correction);
+					// The DST rules may have changed
+					dst_schedule(rtc_now());
 					// Exit menu mode
 					clock_state = NORMAL;
 					display_state = NORMAL;
 					// Disable the time-out timer
 					set_timer = 255;
+					update_display();
 				}
 				break;
 			case DATE:
@@ -535,8 +354,8 @@ int main(void) {
 				display_new[0] = correction_counter / 10000;
 				display_new[1] = correction_counter % 10000 / 100;
 				display_new[2] = correction_counter % 100;
-				display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-				if ((set_button_flag == SHORT_PRESS) || (adv_button_flag == SHORT_PRESS)) {
+				display_update(0);
+				if (pressed) {
 					clock_state = NORMAL;
 					display_state = NORMAL;
 				}
@@ -545,15 +364,159 @@ int main(void) {
 				// Lock the clock to date display only
 				display_new[0] = clock.month;
 				display_new[1] = clock.date;
-				display_new[2] = clock.year;
-				display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
-				if ((set_button_flag == SHORT_PRESS) || (adv_button_flag == SHORT_PRESS)) {
+				display_new[2] = clock.year % 100;
+				display_update(0);
+				if (pressed) {
 					clock_state = NORMAL;
 					display_state = NORMAL;
 				}
 				break;
+			case CP_SERVICE:
+				// Exercise the cathodes, one step per pass so the rest of the clock keeps running
+				cathode_poison_routine();
+				break;
+		}
+		PROFILE_LOOP(awake_start);
+	}
+}
+
+void dst_task(void) {
+	// Take care of daylight saving time, dst_schedule() has already worked out when
+	if (rtc_now() >= dst_next)
+		dst_transition();
+}
+
+void colon_task(void) {
+	// Display or blink the colons depending on mode, runs on the second and the half second
+	if ((scheduler_tick & (TICKS_PER_SECOND - 1)) == 0) {
+		if (display_state != NORMAL)
+			return;
+		if (clock_settings.blinking_colons == 1) {			// Mode 1: .5hz
+			display_colons = 0x00;
+		} else if (clock_settings.blinking_colons == 2) { 	// Mode 2: 1 hz
+			if (display_colons == 0x00) {
+				display_colons = 0x03;
+			} else {
+				display_colons = 0x00;
+			}
+		} else if (clock_settings.blinking_colons == 3) {	// Mode 3: AM/PM
+			if (clock.hour > 11) {
+				display_colons = 0x03;
+			} else {
+				display_colons = 0x00;
+			}
+		} else if (clock_settings.blinking_colons == 4) {	// Mode 4: On
+			display_colons = 0x03;
+		}
+	} else if (clock_state == NORMAL) {
+		if (clock_settings.blinking_colons == 1) {			// Mode 1: Blink @ .5Hz
+			display_colons = 0x03;
+		} else if (clock_settings.blinking_colons == 4) {
+			display_colons = 0x03;
+		}
+	}
+}
+
+void time_task(void) {
+	// Update the global display registers
+	if (display_state == NORMAL) {
+		// Display the time or date depending on mode
+		display_new[1] = clock.minute;
+		display_new[2] = clock.second;
+		// Handle 12/24 hour mode
+		if (!clock_settings.clock_display_24hr) {
+			display_new[0] = clock.hour % 12;
+			if (display_new[0] == 0)
+				display_new[0] = 12;
+		} else {
+			display_new[0] = clock.hour;
+		}
+		
+	// Display is in date mode, display that instead
+	} else if (display_state == DATE) {
+		display_new[0] = clock.month;
+		display_new[1] = clock.date;
+		display_new[2] = clock.year % 100;
+	}
+}
+
+void date_flash_task(void) {
+	// Periodically display the date if enabled
+	if ((clock_settings.display_date) &&
+		(clock_state == NORMAL) &&
+		(clock.second >= clock_settings.display_date_at_seconds) &&
+		(clock.second < clock_settings.display_date_at_seconds + clock_settings.display_date_duration)) {
+		display_new[0] = clock.month;
+		display_new[1] = clock.date;
+		display_new[2] = clock.year % 100;		
+		if (clock_settings.blinking_colons_during_date == 1)
+			display_colons = 0x03;
+		else if (clock_settings.blinking_colons_during_date == 0)
+			display_colons = 0x00;
+	}
+}
+
+void refresh_task(void) {
+	// Hand the new digits to the display, this starts a fade if they changed
+	// In SET mode blink the bank of digits we're setting, off on the second and half second
+	uint8_t blank = 0;
+
+	if ((clock_state != NORMAL) && (clock_state != SET))
+		return;									// The other modes draw for themselves
+	if ((clock_state == SET) && (!(scheduler_tick & 1))) {
+		switch (set_mode) {				
+			case YEAR_SET:
+			case SEC_SET:
+				blank = 0b00000011;
+				break;
+			case DATE_SET:
+			case MIN_SET:
+				blank = 0b00001100;
+				break;
+			case MONTH_SET:
+			case HOUR_SET:
+				blank = 0b00110000;
+				break;
 		}
 	}
+	display_update(blank);
+}
+
+void menu_timeout_task(void) {
+	if ((clock_state == SET) || (clock_state == MENU)){
+		// Increment the set/menu mode timeout timer
+		if (set_timer != 255)
+			set_timer++;
+	}
+}
+
+void load_task(void) {
+	// Publish how busy the main loop was over the last second
+	loop_awake_cycles = awake_time * (F_CPU / DISPLAY_TICKS_PER_SECOND);
+	awake_time = 0;
+	PROFILE_SECOND();
+}
+
+void wait_for_event(void) {
+	// Sleep until one of the RTC, button or power fail interrupts sets loop_wakeup
+	// The display ISRs wake the CPU as well, but it goes straight back to sleep after them
+	awake_time += display_elapsed(awake_start);
+	if (power_failed)
+		while (ASSR & RTC_ASSR_BUSY);			// A Timer2 write still going through would be lost in power save
+	cli();
+	while ((!loop_wakeup) && (!rtc_event_pending()) && (!button_event_pending())) {
+		// Idle keeps the display timer running, power save leaves only the RTC
+		// EEPROM ready can't wake from power save, so a settings write has to finish first
+		set_sleep_mode(((power_failed) && (!settings_writing))?SLEEP_MODE_PWR_SAVE:SLEEP_MODE_IDLE);
+		sleep_enable();
+		sei();									// The instruction after sei always runs, so no wakeup can be missed
+		sleep_cpu();
+		sleep_disable();
+		cli();
+	}
+	loop_wakeup = FALSE;
+	sei();
+	awake_start = display_timestamp();
 }
 
 void update_display(void) {
@@ -570,9 +533,9 @@ void update_display(void) {
 	} else if (display_state == DATE) {
 		display_new[0] = clock.month;
 		display_new[1] = clock.date;
-		display_new[2] = clock.year;
+		display_new[2] = clock.year % 100;
 	}
-	display_set_digits(display_new[0], display_new[1], display_new[2], display_colons);
+	display_update(0);
 }
 
 void increment_time_date(uint8_t set_mode) {
@@ -594,36 +557,21 @@ void increment_time_date(uint8_t set_mode) {
 				clock.month = 1;
 			break;
 		case DATE_SET:
-			if (++clock.date==32) {
-				clock.date=1;
-			} else if (clock.date==31) {
-				if ((clock.month==4) || (clock.month==6) || (clock.month==9) || (clock.month==11)) {
-					clock.date=1;
-				}
-			} else if (clock.date==30) {
-				if(clock.month==2) {
-					clock.date=1;
-				}
-			} else if (clock.date==29) {
-				if((clock.month==2) && (not_leap())) {
-					clock.date=1;
-				}
-			}
-
-			clock.day = calculate_day_of_week();	
+			if (++clock.date > calendar_days_in_month(clock.year, clock.month))
+				clock.date = 1;
 			break;
 		case YEAR_SET:
 			if (++clock.year==100)
 				clock.year = 0;
 			break;
 	}
-	correction_counter = 0;			// We changed the time, restart counter for software time correction
+	rtc_set_clock();				// Hand the new time to the RTC
+	dst_schedule(rtc_now());		// and find the next DST change from there
 }
 
 void read_menu_setting(uint8_t field_values[2], uint8_t menu_option) {
 	int16_t temp_val = 0;
 	display_colons = 0x00;
-	clock.day = calculate_day_of_week();
 	field_values[0] = 0;
 	field_values[1] = 0;
 	switch (menu_option) {
@@ -714,6 +662,12 @@ void read_menu_setting(uint8_t field_values[2], uint8_t menu_option) {
 		case 25:
 			field_values[1] = clock.day;
 			break;
+#ifdef ISR_STATS
+		default:
+			if (menu_option >= ISR_STATS_MENU_FIRST)
+				isr_stats_read(field_values, menu_option - ISR_STATS_MENU_FIRST);
+			break;
+#endif
 	}
 }
 
@@ -722,94 +676,116 @@ void increment_menu_setting(uint8_t menu_option, uint8_t speed) {
 		case 1:
 			if (++clock_settings.clock_display_24hr > 1)
 				clock_settings.clock_display_24hr = 0;
+			settings_changed();
 			break;
 		case 2:
 			if (++clock_settings.leading_zero_blank > 1)
 				clock_settings.leading_zero_blank = 0;
+			settings_changed();
 			break;
 		case 3:
 			if (++clock_settings.crossfade_enable > 1)
 				clock_settings.crossfade_enable = 0;
+			settings_changed();
 			break;
 		case 4:
 			if (++clock_settings.crossfade_step > 10)
 				clock_settings.crossfade_step = 1;
+			settings_changed();
 			break;
 		case 5:
 			if (++clock_settings.blinking_colons > 4)
 				clock_settings.blinking_colons = 0;
+			settings_changed();
 			break;
 		case 6:
 			if (++clock_settings.blinking_colons_during_date > 2)
 				clock_settings.blinking_colons_during_date = 0;
+			settings_changed();
 			break;
 		case 7:
 			if (++clock_settings.display_date > 1)
-				clock_settings.blinking_colons_during_date = 0;
+				clock_settings.display_date = 0;
+			settings_changed();
 			break;
 		case 8:
 			if (clock_settings.display_date_at_seconds < 50)
 				clock_settings.display_date_at_seconds += 10;
 			else
 				clock_settings.display_date_at_seconds = 0;
+			settings_changed();
 			break;
 		case 9:
 			if (++clock_settings.display_date_duration > 10)
 				clock_settings.display_date_duration = 1;
+			settings_changed();
 			break;
 		case 10:
 			if (clock_settings.brightness < 100)
 				clock_settings.brightness += 10;
 			else
 				clock_settings.brightness = 10;
+			settings_changed();
 			break;
 		case 11:
 			if (++clock_settings.cathode_poison_prevention_enabled > 1)
 				clock_settings.cathode_poison_prevention_enabled = 0;
+			settings_changed();
 			break;
 		case 12:
 			if (++clock_settings.cathode_poison_start_hour > 23)
 				clock_settings.cathode_poison_start_hour = 0;
+			settings_changed();
 			break;
 		case 13:
 			if (++clock_settings.cathode_poisoning_duration > 12)
 				clock_settings.cathode_poisoning_duration = 1;
+			settings_changed();
 			break;
 		case 14:
 			if (++clock_settings.daylight_saving_enable > 1)
 				clock_settings.daylight_saving_enable = 0;
+			settings_changed();
 			break;
 		case 15:
 			if (++clock_settings.spring_ahead_hour > 22)
 				clock_settings.spring_ahead_hour = 1;
+			settings_changed();
 			break;
 		case 16:
 			if (++clock_settings.spring_ahead_day > 6)
 				clock_settings.spring_ahead_day = 0;
+			settings_changed();
 			break;
 		case 17:
-			if (++clock_settings.spring_ahead_week > 4)
+			if (++clock_settings.spring_ahead_week > DST_LAST_WEEK)
 				clock_settings.spring_ahead_week = 1;
+			settings_changed();
 			break;
 		case 18:
 			if (++clock_settings.spring_ahead_month > 12)
 				clock_settings.spring_ahead_month = 1;
+			settings_changed();
 			break;
 		case 19:
 			if (++clock_settings.fall_back_hour > 22)
 				clock_settings.fall_back_hour = 1;
+			settings_changed();
 			break;
 		case 20:
 			if (++clock_settings.fall_back_day > 6)
 				clock_settings.fall_back_day = 0;
+			settings_changed();
 			break;
 		case 21:
-			if (++clock_settings.fall_back_week > 4)
+			if (++clock_settings.fall_back_week > DST_LAST_WEEK)
 				clock_settings.fall_back_week = 1;
+			settings_changed();
 			break;
 		case 22:
 			if (++clock_settings.fall_back_month > 12)
 				clock_settings.fall_back_month = 1;
+			settings_changed();
 			break;
 		case 23:
 		//	field_value[1] = clock_settings.pwm_freq;
@@ -846,78 +822,58 @@ void increment_menu_setting(uint8_t menu_option, uint8_t speed) {
 					}
 				}
 			}
+			settings_changed();
 			break;
+#ifdef ISR_STATS
+		default:
+			if (menu_option >= ISR_STATS_MENU_FIRST)
+				isr_stats_next_page();
+			break;
+#endif
 	}
 }
 
-void exercise_display(uint16_t delay_ms) {
-// Demand full brightness and no crossface for the glorious exercise
-	TIMSK &= ~((1 << OCIE1A) | (1 << OCIE1B));	// disable interrupts for the display
-	for (int i = 0; i < 10; i++) {
-		int temp = i * 10 + i;
-		display_new[0] = temp;
-		display_new[1] = temp;
-		display_new[2] = temp;
-		display_set_digits(display_new[0], display_new[1], display_new[2], 0x03);
-		_delay_ms(delay_ms);
-	}
-	display_new[0] = clock.hour;
-	display_new[1] = clock.minute;
-	display_new[2] = clock.second;
-	TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);		// Enable interrupts on timer 1 A and B compare
-	TCNT1H = 0x00;								// Set the initial timer value to 0
-	TCNT1L = 0x00;
-	OCR1AL = display_duty_cycle;				// start a fade and set compa to the extreme
+uint8_t cathode_poison_due(void) {
+	// Is the Cathode Poisoning Prevention window open?
+	return (clock_settings.cathode_poison_prevention_enabled) &&
+		   (clock.hour >= clock_settings.cathode_poison_start_hour) &&
+		   (clock.hour < clock_settings.cathode_poison_start_hour + clock_settings.cathode_poisoning_duration);
 }
 
 void cathode_poison_routine(void) {
-	uint8_t temp;	
-	// Demand full brightness and no crossface
-	TIMSK &= ~((1 << OCIE1A) | (1 << OCIE1B));	// disable interrupts for the display
-	display_state == CP_SERVICE;
-	while (clock.hour < (clock_settings.cathode_poison_start_hour + clock_settings.cathode_poisoning_duration)) {
-		if (clock.second < 3) {
-			display_new[0] = clock.hour;
-			display_new[1] = clock.minute;
-			display_new[2] = clock.second;			
-			if (!clock_settings.clock_display_24hr) {
-				display_new[0] %= 12;
-				if (display_new[0] == 0)
-					display_new[0] = 12;	
-			}
-			display_set_digits(display_new[0], display_new[1], display_new[2], 0x00);
-		} else {
-			uint8_t temp = clock.minute / 6;
-			temp = temp * 10 + temp;
-			display_set_digits(temp, temp, temp, 0x03);
-		}
-		// Check if the user is doing something to the buttons
-		if ((set_button_flag != NOT_PRESSED) || (adv_button_flag != NOT_PRESSED))
-			break;
-		// Check for a power failure
-		if (!(PF_PORT & (1 << PF_PIN)))
-			break;
+	// One step of the Cathode Poisoning Prevention service, called from the CP_SERVICE state
+	// The time shows for the first few seconds of each minute, the rest of the minute one digit
+	// is lit on every tube, moving to the next digit every 6 minutes
+	if ((!cathode_poison_due()) ||
+		(button_state) ||												// User is doing something to the buttons
+		(power_failed)) {
+		// Done, or interrupted, back to the time
+		override_pwm = FALSE;
+		clock_state = NORMAL;
+		display_state = NORMAL;
+		update_display();
+		return;
 	}
-	TIMSK |= (1 << OCIE1A) | (1 << OCIE1B);		// Enable interrupts on timer 1 A and B compare
-	TCNT1H = 0x00;								// Set the initial timer value to 0
-	TCNT1L = 0x00;
-	OCR1AL = display_duty_cycle;				// start a fade and set compa to the extreme
-	display_state = NORMAL;
-}
 
-clock_settings_t ReadEEPROM(void){
-	clock_settings_t temp;
-	eeprom_read_block((void*)&temp, (const void*)&clock_settings_eeprom, sizeof(clock_settings_t));
-  
-	correction_value = 60480000 / (uint32_t)((clock_settings.software_time_correction > 0)?
-									clock_settings.software_time_correction:
-									clock_settings.software_time_correction * -1);
-   return(temp);
-}
-
-void UpdateSettings(clock_settings_t a){
-	eeprom_update_block((const void*)&a, (void*)&clock_settings_eeprom, sizeof(clock_settings_t));
-	//eeprom_write_block((const void*)&a, (void*)&clock_settings_eeprom, sizeof(clock_settings_t));
+	if (clock.second < 3) {
+		display_new[0] = clock.hour;
+		display_new[1] = clock.minute;
+		display_new[2] = clock.second;			
+		if (!clock_settings.clock_display_24hr) {
+			display_new[0] %= 12;
+			if (display_new[0] == 0)
+				display_new[0] = 12;	
+		}
+		display_colons = 0x00;
+	} else {
+		uint8_t temp = clock.minute / 6;
+		temp = temp * 10 + temp;
+		display_new[0] = temp;
+		display_new[1] = temp;
+		display_new[2] = temp;
+		display_colons = 0x03;
+	}
+	display_update(0);
 }
 
 void WriteDefaultSettings(void) {
@@ -950,8 +906,8 @@ void WriteDefaultSettings(void) {
 	clock_settings.software_time_correction = 194;				//Opt 24:	number of seconds per week to add or subtract		def: 1.94
 																			// 	left colon on for negative numbers
 																//Opt 25: Day of week 0:Sunday 6:Saturday						R/O
-	clock_settings.magic_number = MAGIC_NUMBER;					// Used to see if the EEPROM has been set
-	UpdateSettings(clock_settings);
+	settings_changed();
+	settings_commit();
 }
 
 void set_display_duty_cycle(uint8_t brightness) {
@@ -990,53 +946,4 @@ void set_display_duty_cycle(uint8_t brightness) {
 		default:
 			display_duty_cycle = 240;
 	}
-}
-
-uint8_t calculate_day_of_week(void) {
-	// Takes the date and returns the day of week
-	// Sunday = 0, Monday = 1 ... Saturday = 6
-	// **Only works for years in the 2000's
-	uint8_t temp;
-	temp = clock.year / 4;
-	temp += clock.date;
-	switch (clock.month) {
-		case 1:
-		case 10:
-			temp += 1;
-			break;
-		case 5:
-			temp += 2;
-			break;
-		case 2:
-		case 3:
-		case 11:
-			temp += 4;
-			break;
-		case 4:
-		case 7:
-			break;
-		case 9:
-		case 12:
-			temp += 6;
-			break;
-		case 6:
-			temp += 5;
-			break;
-		case 8:
-			temp += 3;
-			break;
-	}
-	
-	if (!(clock.year % 4))
-		if ((clock.month == 1) || (clock.month == 2))
-			temp -= 1;
-	
-	temp += 6;
-	temp += clock.year;
-	temp %= 7;
-	
-	if (temp == 0)
-		temp = 7;
-	
-	return temp - 1;
 }
\ No newline at end of file
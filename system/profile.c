@@ -0,0 +1,73 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+
+#include <avr/io.h>
+#include <string.h>
+
+#include "../include/display.h"
+#include "../include/profile.h"
+
+#ifdef PROFILE
+
+profile_t profile __attribute__ ((section (".noinit")));
+
+void profile_init(void) {
+	// Keep what was there through a warm reset, anything else is garbage
+	if ((profile.magic == PROFILE_MAGIC) && (profile.size == sizeof(profile_t)))
+		return;
+	memset(&profile, 0, sizeof(profile_t));
+	profile.magic = PROFILE_MAGIC;
+	profile.size = sizeof(profile_t);
+}
+
+void profile_latency(uint8_t type, uint32_t since) {
+	// An event of this type queued at since is being picked up now
+	uint32_t ticks = display_elapsed(since);
+	uint32_t scaled = ticks >> PROFILE_SHIFT;
+	uint8_t bucket = 0;
+
+	while ((scaled) && (bucket < PROFILE_BUCKETS - 1)) {
+		bucket++;
+		scaled >>= 1;
+	}
+	if (profile.latency[type][bucket] != 0xFFFF)
+		profile.latency[type][bucket]++;
+	if (ticks > profile.latency_max[type])
+		profile.latency_max[type] = ticks;
+}
+
+void profile_loop(uint32_t start) {
+	// End of a main loop pass that woke up at start
+	uint32_t ticks = display_elapsed(start);
+
+	if (profile.loops != 0xFFFF)
+		profile.loops++;
+	if (ticks > profile.longest_loop)
+		profile.longest_loop = ticks;
+}
+
+void profile_second(void) {
+	// Once a second from the main loop
+	profile.loops_per_second = profile.loops;
+	if (profile.loops > profile.loops_per_second_max)
+		profile.loops_per_second_max = profile.loops;
+	profile.loops = 0;
+}
+
+#endif // PROFILE
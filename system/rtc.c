@@ -18,103 +18,154 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "../include/rtc.h"
 #include "../include/nixie.h"
 #include "../include/display.h"
 #include "../include/buttons.h"
+#include "../include/calendar.h"
+#include "../include/isrstats.h"
+#include "../include/profile.h"
 
-// Global Time of Day Cache
-volatile timespec_t clock;
-volatile uint8_t sentinal = CLEAR;
+// Seconds since midnight 1/1/2000, the only time the RTC ISR keeps
+// Along with the correction phase it lives in .noinit so a reset that isn't power on can pick
+// the time back up, rtc_check is the complement of both so we can tell if RAM survived
+volatile uint32_t rtc_seconds __attribute__ ((section (".noinit")));
+volatile uint32_t correction_phase __attribute__ ((section (".noinit")));
+static volatile uint32_t rtc_check __attribute__ ((section (".noinit")));
+static uint8_t rtc_resumed = FALSE;
+
+// Global Time of Day Cache, the calendar breakdown of rtc_seconds for the main loop
+timespec_t clock;
+static uint32_t clock_seconds;								// rtc_seconds that clock is showing
+
+// RTC event queue, the Timer2 ISRs produce and the main loop consumes
+// Each side only writes its own index so neither needs to lock the other out
+static volatile uint8_t rtc_event_queue[RTC_EVENT_QUEUE_SIZE];
+static volatile uint8_t rtc_event_head = 0;				// Next free slot, written by the ISRs
+static volatile uint8_t rtc_event_tail = 0;				// Oldest event, written by the main loop
+volatile uint16_t rtc_event_late = 0;
+volatile uint16_t rtc_event_overflows = 0;
+volatile uint8_t rtc_event_max_depth = 0;
+#ifdef PROFILE
+static uint32_t rtc_event_time[RTC_EVENT_QUEUE_SIZE];	// display_timestamp() when each was queued
+#endif
 
 // Clock variables
 volatile uint8_t set_mode = NORMAL;
 volatile uint8_t clock_state;
-volatile uint8_t unlock_correction = FALSE;
-volatile int8_t correction;
-volatile int8_t dst_handled;
+
+// Software time correction phase, every second adds |correction| * 256 and every RTC_CORRECTION_PERIOD
+// that piles up is one tick of Timer2 to add or drop, so the trims come evenly spaced through the week
+static volatile uint32_t correction_step;
+static volatile int8_t correction_sign;
+static volatile int8_t correction_trim;					// Tick waiting to be applied at the next compare
+
+static inline void rtc_seal(void) {
+	// Update the check after changing rtc_seconds or correction_phase, interrupts have to be off
+	rtc_check = ~(rtc_seconds ^ correction_phase);
+}
+
+static inline void rtc_event_push(uint8_t event) {
+	uint8_t head = rtc_event_head;
+	uint8_t next = (head + 1) & (RTC_EVENT_QUEUE_SIZE - 1);
+	uint8_t depth = (next - rtc_event_tail) & (RTC_EVENT_QUEUE_SIZE - 1);
+
+	loop_wakeup = TRUE;
+	if (next == rtc_event_tail) {
+		rtc_event_overflows++;					// Full, the main loop is way behind
+		return;
+	}
+	if (head != rtc_event_tail)
+		rtc_event_late++;						// The last one hasn't been handled yet
+	if (depth > rtc_event_max_depth)
+		rtc_event_max_depth = depth;
+	rtc_event_queue[head] = event;
+#ifdef PROFILE
+	rtc_event_time[head] = display_timestamp();
+#endif
+	rtc_event_head = next;
+}
+
+uint8_t rtc_event_pop(void) {
+	// Returns the oldest event, or CLEAR if there is nothing waiting
+	uint8_t tail = rtc_event_tail;
+	uint8_t event;
+
+	if (tail == rtc_event_head)
+		return CLEAR;
+	event = rtc_event_queue[tail];
+	PROFILE_LATENCY(event - 1, rtc_event_time[tail]);
+	rtc_event_tail = (tail + 1) & (RTC_EVENT_QUEUE_SIZE - 1);
+	return event;
+}
+
+uint8_t rtc_event_pending(void) {
+	return rtc_event_head != rtc_event_tail;
+}
 
 ISR(TIMER2_COMP_vect) __attribute__ ((hot));
 ISR(TIMER2_COMP_vect) {
+	ISR_STATS_BEGIN(ISR_STATS_TIMER2_COMP, (1 << OCF2));
 	// Fractional second interrupt, 1/4 1/2 and 3/4
+	// Nudge the counter a tick first, every compare is well clear of the overflow and the next one
+	// Only once the last Timer2 writes have landed, otherwise leave it for the next compare rather than wait
+	// We're just past the TOSC1 edge that matched, so TCNT2 won't move under the read modify write
+	// Not while the power is out, this woke us from power save and TCNT2 can read stale until the next TOSC1 edge
+	if ((correction_trim) && (!power_failed) && (!(ASSR & ((1<<TCN2UB)|(1<<OCR2UB))))) {
+		TCNT2 = TCNT2 + correction_trim;
+		correction_trim = 0;
+	}
 	switch (OCR2) {
 		case 64:								// 1/4 second interrupt
 			OCR2 = 128;							// Set the compare for 1/2 second
-			sentinal = QRTR_SECOND;
+			rtc_event_push(QRTR_SECOND);
 			break;
 		case 128:								// Half second interrupt
-			sentinal = HALF_SECOND;
+			rtc_event_push(HALF_SECOND);
 			OCR2 = 192;							// Set the compare for 3/4 second
 			break;			
 		case 192:								// 3/4 second interrupt
-			sentinal = TQRT_SECOND;
+			rtc_event_push(TQRT_SECOND);
 			OCR2 = 64;							// Set the compare for 1/4 second	
 			break;
 	}
+	button_wake();							// Look for a press while Timer0 is stopped
 }
 
 ISR(TIMER2_OVF_vect) __attribute__ ((hot));
 ISR(TIMER2_OVF_vect) {
-	// Second increment interrupt	
-	sentinal = SECOND;					// Set the sentinel so we dont have to do so much shit in the ISR
-	
+	ISR_STATS_BEGIN(ISR_STATS_TIMER2_OVF, (1 << TOV2));
+	// Second increment interrupt, the main loop works out the calendar from the count
+	rtc_seconds++;
+
 	// Software time correction
-	if (correction_flag > 0) {
-		// Add a second
-		if (clock.second < 59) {
-			clock.second += 1;
-			correction_flag = 0;
-			correction_counter = 0x0000;
-		}
-	} else if (correction_flag < 0) {
-		// Subtract a second
-		if (clock.second > 0) {
-			clock.second -= 1;
-			correction_flag = 0;
-			correction_counter = 0x0000;
-		}
-	}
-	
-	if (++clock.second==60)	{			//keep track of time, date, month, and year
-		clock.second=0;
-		if (++clock.minute==60) {
-			clock.minute=0;
-			if (++clock.hour==24) {
-				clock.hour=0;
-				unlock_correction = 1;
-				dst_handled = 0;
-				if (++clock.day==7) 
-					clock.day=0;
-				if (++clock.date==32) {
-					clock.month++;
-					clock.date=1;
-				} else if (clock.date==31) {
-					if ((clock.month==4) || (clock.month==6) || (clock.month==9) || (clock.month==11)) {
-						clock.month++;
-						clock.date=1;
-					}
-				} else if (clock.date==30) {
-					if(clock.month==2) {
-						clock.month++;
-						clock.date=1;
-					}
-				} else if (clock.date==29) {
-					if((clock.month==2) && (not_leap())) {
-						clock.month++;
-						clock.date=1;
-					}
-				}
-				if (clock.month==13) {
-					clock.month=1;
-					clock.year++;
-				}
-			}
+	if (correction_step) {
+		correction_phase += correction_step;
+		if (correction_phase >= RTC_CORRECTION_PERIOD) {
+			correction_phase -= RTC_CORRECTION_PERIOD;
+			correction_trim = correction_sign;		// Positive runs the next second a tick short
 		}
 	}
+	rtc_seal();
+	rtc_event_push(SECOND);				// Queue the event so we dont have to do so much shit in the ISR
+	button_wake();
 }
 
 void init_rtc(void) {
+	// Start from 1/1/2020 unless rtc_resume() found the time still in RAM
+	if (!rtc_resumed) {
+		clock.hour = 0;
+		clock.minute = 0;
+		clock.second = 0;
+		clock.date = 1;
+		clock.month = 1;
+		clock.year = 20;
+		correction_phase = 0;
+		rtc_set_clock();									// Works out the day of the week too
+	}
+
 	cli();													// Stop interrupts while we set everything up
 	ASSR |= (1<<AS2);										// set Timer/counter0 to be asynchronous from the CPU clock
 															//  with a second external clock (32,768kHz)driving it.
@@ -122,26 +173,123 @@ void init_rtc(void) {
 	OCR2 = 64;												// Set the compare for 1/4 second
 	TCCR2 =(1<<CS20)|(1<<CS22);								// Prescale the timer to be clock source/128 to make it
 															//  exactly 1 second for every overflow to occur
-	while (ASSR & ((1<<TCN2UB)|(1<<OCR2UB)|(1<<TCR2UB)));	// Wait until TC2 is updated
+	while (ASSR & RTC_ASSR_BUSY);							// Wait until TC2 is updated
 	TIFR = (1<<TOV2);
 	TIMSK |= (1<<TOIE2)|(1<<OCIE2);							// Set 8-bit Timer/Counter2 Overflow and Compare Interrupt Enable
 	sei();													// Set the Global Interrupt Enable Bit
-	
-	clock.hour = 0;
-	clock.minute = 0;
-	clock.second = 0;
-	clock.date = 1;
-	clock.day = 0;		//0 = sunday, 6 = saturday
-	clock.month = 1;
-	clock.year = 20;
-	clock.day = calculate_day_of_week();	
-	dst_handled = 0;
 }
 
-char not_leap(void) {										//check for leap year
-	if (!(clock.year%100)) {
-		return (char)(clock.year%400);
-	} else {
-		return (char)(clock.year%4);
+static void rtc_breakdown(uint32_t seconds) {
+	// Work out every field of clock from scratch
+	uint16_t days = seconds / 86400UL;
+	uint32_t rem = seconds % 86400UL;
+
+	clock.hour = rem / 3600;
+	rem -= clock.hour * 3600UL;
+	clock.minute = (uint16_t)rem / 60;
+	clock.second = (uint16_t)rem % 60;
+	clock.day = calendar_day_of_week(days);
+	calendar_date(days, &clock.year, &clock.month, &clock.date);
+}
+
+uint8_t rtc_resume(void) {
+	// After a watchdog, external or brown out reset RAM may still have the time, check it and carry on
+	// Timer2 was reset too, so the fraction of the second and the reset itself are lost
+	uint32_t seconds = rtc_seconds;
+	uint32_t phase = correction_phase;
+
+	if ((rtc_check != ~(seconds ^ phase)) || (phase >= RTC_CORRECTION_PERIOD))
+		return FALSE;
+	rtc_breakdown(seconds);
+	clock_seconds = seconds;
+	rtc_resumed = TRUE;
+	return TRUE;
+}
+
+void rtc_sync(void) {
+	// Bring clock up to date with rtc_seconds, only touching the fields that changed
+	uint32_t seconds = rtc_now();
+	uint32_t elapsed;
+
+	elapsed = seconds - clock_seconds;
+	if (elapsed == 0)
+		return;
+	clock_seconds = seconds;
+
+	if (elapsed >= 60) {
+		// Jumped, the time was set or adjusted
+		rtc_breakdown(seconds);
+	} else if ((clock.second += elapsed) >= 60) {
+		// The usual case is a second or two, carry it up through the fields
+		clock.second -= 60;
+		if (++clock.minute == 60) {
+			clock.minute = 0;
+			if (++clock.hour == 24) {
+				clock.hour = 0;
+				if (++clock.day == 7)
+					clock.day = 0;
+				if (++clock.date > calendar_days_in_month(clock.year, clock.month)) {
+					clock.date = 1;
+					if (++clock.month == 13) {
+						clock.month = 1;
+						clock.year++;
+					}
+				}
+			}
+		}
+	}
+}
+
+void rtc_set_clock(void) {
+	// Set the time from the fields in clock, the day of the week is worked out here
+	uint16_t days = calendar_days(clock.year, clock.month, clock.date);
+	uint32_t seconds;
+
+	clock.day = calendar_day_of_week(days);
+	seconds = days * 86400UL + clock.hour * 3600UL + clock.minute * 60 + clock.second;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rtc_seconds = seconds;
+		rtc_seal();
 	}
-}
\ No newline at end of file
+	clock_seconds = seconds;
+}
+
+void rtc_restore(uint32_t seconds, uint32_t phase) {
+	// Pick up from a saved time and correction phase
+	if (phase >= RTC_CORRECTION_PERIOD)
+		phase = 0;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rtc_seconds = seconds;
+		correction_phase = phase;
+		rtc_seal();
+	}
+	rtc_breakdown(seconds);
+	clock_seconds = seconds;
+}
+
+uint32_t rtc_now(void) {
+	uint32_t seconds;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		seconds = rtc_seconds;
+	}
+	return seconds;
+}
+
+void rtc_adjust(int32_t seconds) {
+	// Move the time forward or back, for daylight saving time
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		rtc_seconds += seconds;
+		rtc_seal();
+	}
+	rtc_sync();
+}
+
+void rtc_set_correction(int16_t correction) {
+	// Only needs calling when the setting changes, the ISR just adds
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		correction_sign = (correction < 0)?-1:1;
+		correction_step = (uint32_t)((correction < 0)?-correction:correction) * RTC_TICKS_PER_SECOND;
+	}
+}
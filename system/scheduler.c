@@ -0,0 +1,74 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+
+#include "../include/scheduler.h"
+#include "../include/rtc.h"
+#include "../include/display.h"
+
+// Registered tasks, run in the order they were added
+task_t tasks[MAX_TASKS];
+uint8_t task_count = 0;
+uint8_t scheduler_tick = 0;
+
+void scheduler_add(void (*run)(void), uint8_t period, uint8_t phase) {
+	task_t *task;
+
+	if (task_count >= MAX_TASKS)
+		return;
+	task = &tasks[task_count++];
+	task->run = run;
+	task->period = period;
+	task->phase = phase;
+	task->runs = 0;
+	task->wcet = 0;
+}
+
+void scheduler_dispatch(uint8_t event) {
+	// Run every task that is due on this RTC event
+	uint8_t i;
+	uint32_t start, elapsed;
+
+	// Line the tick counter up with the event, so a missed event can't shift the phases
+	switch (event) {
+		case QRTR_SECOND:
+		case HALF_SECOND:
+		case TQRT_SECOND:
+			scheduler_tick = (scheduler_tick & ~(TICKS_PER_SECOND - 1)) | event;
+			break;
+		case SECOND:
+			scheduler_tick = (scheduler_tick | (TICKS_PER_SECOND - 1)) + 1;
+			break;
+		default:
+			return;
+	}
+
+	for (i = 0; i < task_count; i++) {
+		task_t *task = &tasks[i];
+
+		if ((scheduler_tick & (task->period - 1)) != task->phase)
+			continue;
+		start = display_timestamp();
+		task->run();
+		elapsed = display_elapsed(start);
+		task->runs++;
+		if (elapsed > task->wcet)
+			task->wcet = (elapsed > 0xFFFF)?0xFFFF:elapsed;
+	}
+}
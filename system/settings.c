@@ -0,0 +1,290 @@
+// vim: set tabstop=4 shiftwidth=4 expandtab :
+//
+// nixietherm-firmware - NixieClock Mega Main Firmware Program
+// Copyright (C) 2020 Edward Koloski
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http:#www.gnu.org/licenses/>.
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include <util/atomic.h>
+
+#include "../include/settings.h"
+#include "../include/nixie.h"
+#include "../include/rtc.h"
+
+// Where the current record lives, the next commit goes in the slot after it
+// With no journal yet the first record goes in slot 1, slot 0 overlaps the legacy block and a half
+// written record there could leave the old magic sitting over shifted settings
+static volatile uint8_t settings_slot = 0;
+static volatile uint16_t settings_seq = 0;
+
+// Background writer, EE_RDY streams a settings record or a time snapshot into EEPROM a byte at a time
+static uint8_t settings_record[SETTINGS_SLOT_SIZE];
+static volatile uint8_t settings_write_slot;
+static const uint8_t * volatile settings_write_data;
+static volatile uint16_t settings_write_address;
+static volatile uint8_t settings_write_length;
+static volatile uint8_t settings_write_index;
+static volatile uint8_t settings_again;				// Settings record to (re)start when the current write is done
+volatile uint8_t settings_writing = FALSE;
+volatile uint8_t settings_dirty = FALSE;				// Only says whether to commit, the writer finds the changed bytes
+
+// Power fail snapshots
+static uint8_t snapshot_record[SNAPSHOT_SIZE];
+static volatile uint8_t snapshot_slot = 0;
+static uint8_t snapshot_seq = 0;
+static volatile uint32_t snapshot_seconds;			// Time in the last snapshot
+
+typedef char settings_fit_check[(sizeof(clock_settings_t) <= SETTINGS_PAYLOAD_MAX)?1:-1];
+typedef char snapshot_budget_check[(SNAPSHOT_WORST_US <= SNAPSHOT_BUDGET_US)?1:-1];
+
+#define SNAPSHOT_STR(x)		#x
+#define SNAPSHOT_XSTR(x)	SNAPSHOT_STR(x)
+#pragma message "power fail snapshot worst case (us): " SNAPSHOT_XSTR(SNAPSHOT_WORST_US) " of " SNAPSHOT_XSTR(SNAPSHOT_BUDGET_US)
+
+static inline uint8_t *settings_address(uint8_t slot, uint8_t offset) {
+	return (uint8_t *)(uintptr_t)(SETTINGS_BASE + (slot * SETTINGS_SLOT_SIZE) + offset);
+}
+
+static uint16_t settings_read_word(const uint8_t *address) {
+	return eeprom_read_byte(address) | ((uint16_t)eeprom_read_byte(address + 1) << 8);
+}
+
+static uint8_t settings_valid(uint8_t slot) {
+	// Check the CRC over everything in the slot but the CRC itself
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	for (i = 0; i < SETTINGS_CRC; i++)
+		crc = _crc16_update(crc, eeprom_read_byte(settings_address(slot, i)));
+	return crc == settings_read_word(settings_address(slot, SETTINGS_CRC));
+}
+
+static void settings_migrate(uint8_t version) {
+	// Bring an older layout in clock_settings up to SETTINGS_VERSION, each step falls through to the next
+	switch (version) {
+		case 0:				// Legacy block, the same fields as version 1 without the header
+		default:
+			break;
+	}
+}
+
+uint8_t settings_load(void) {
+	// Read the newest good record into clock_settings, returns FALSE if there isn't one
+	uint8_t slot, version;
+	uint16_t seq;
+	uint8_t found = FALSE;
+
+	for (slot = 0; slot < SETTINGS_SLOTS; slot++) {
+		if (!settings_valid(slot))
+			continue;
+		if (eeprom_read_byte(settings_address(slot, SETTINGS_VERSION_OFFSET)) > SETTINGS_VERSION)
+			continue;								// Written by newer firmware, we can't read it
+		seq = settings_read_word(settings_address(slot, SETTINGS_SEQ));
+		if ((!found) || ((int16_t)(seq - settings_seq) > 0)) {
+			found = TRUE;
+			settings_slot = slot;
+			settings_seq = seq;
+		}
+	}
+
+	if (found) {
+		version = eeprom_read_byte(settings_address(settings_slot, SETTINGS_VERSION_OFFSET));
+		eeprom_read_block((void *)&clock_settings, settings_address(settings_slot, SETTINGS_PAYLOAD), sizeof(clock_settings_t));
+	} else if (eeprom_read_byte((const uint8_t *)(uintptr_t)SETTINGS_LEGACY_MAGIC_ADDR) == SETTINGS_LEGACY_MAGIC) {
+		// Settings from the old firmware, bring them over into the journal
+		version = 0;
+		eeprom_read_block((void *)&clock_settings, (const void *)(uintptr_t)SETTINGS_LEGACY_ADDR, sizeof(clock_settings_t));
+	} else {
+		return FALSE;
+	}
+
+	if (version != SETTINGS_VERSION) {
+		settings_migrate(version);
+		settings_changed();
+		settings_commit();
+	}
+	return TRUE;
+}
+
+static void settings_start(void) {
+	// Snapshot clock_settings into a record for the next slot and start the writer on it
+	// Later changes go to the next commit, so the record can't tear
+	uint8_t slot = (settings_slot + 1) % SETTINGS_SLOTS;
+	uint16_t seq = settings_seq + 1;
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	settings_dirty = FALSE;
+	settings_record[SETTINGS_SEQ] = seq;
+	settings_record[SETTINGS_SEQ + 1] = seq >> 8;
+	settings_record[SETTINGS_VERSION_OFFSET] = SETTINGS_VERSION;
+	for (i = SETTINGS_PAYLOAD; i < SETTINGS_CRC; i++) {
+		if (i < SETTINGS_PAYLOAD + sizeof(clock_settings_t))
+			settings_record[i] = ((const volatile uint8_t *)&clock_settings)[i - SETTINGS_PAYLOAD];
+		else
+			settings_record[i] = 0xFF;				// Unused
+	}
+	for (i = 0; i < SETTINGS_CRC; i++)
+		crc = _crc16_update(crc, settings_record[i]);
+	settings_record[SETTINGS_CRC] = crc;
+	settings_record[SETTINGS_CRC + 1] = crc >> 8;
+
+	settings_write_slot = slot;
+	settings_write_data = settings_record;
+	settings_write_address = SETTINGS_BASE + (slot * SETTINGS_SLOT_SIZE);
+	settings_write_length = SETTINGS_SLOT_SIZE;
+	settings_write_index = 0;
+	settings_writing = TRUE;
+	EECR |= (1 << EERIE);							// Fires straight away if the EEPROM is idle
+}
+
+ISR(EE_RDY_vect) {
+	// EEPROM is ready for the next byte, bytes that already match are skipped
+	// In order, so the check byte at the end of a record or snapshot is the last thing written
+	uint8_t i = settings_write_index;
+
+	for (; i < settings_write_length; i++) {
+		EEAR = settings_write_address + i;
+		EECR |= (1 << EERE);
+		if (EEDR != settings_write_data[i])
+			break;
+	}
+
+	if (i == settings_write_length) {
+		if (settings_write_data == snapshot_record) {
+			snapshot_slot = (snapshot_slot + 1) % SNAPSHOT_SLOTS;
+		} else {
+			// All there, it's the current record now
+			settings_slot = settings_write_slot;
+			settings_seq = settings_record[SETTINGS_SEQ] | ((uint16_t)settings_record[SETTINGS_SEQ + 1] << 8);
+		}
+		if (settings_again) {
+			settings_again = FALSE;
+			settings_start();
+		} else {
+			EECR &= ~(1 << EERIE);
+			settings_writing = FALSE;
+			loop_wakeup = TRUE;
+		}
+		return;
+	}
+
+	EEDR = settings_write_data[i];					// EEAR is already pointing at it
+	EECR |= (1 << EEMWE);
+	EECR |= (1 << EEWE);							// Has to be within four cycles of EEMWE
+	settings_write_index = i + 1;
+}
+
+void settings_changed(void) {
+	// Call after changing clock_settings, a commit only writes if something changed
+	settings_dirty = TRUE;
+}
+
+void settings_commit(void) {
+	// Write out clock_settings in the background if anything has changed, returns straight away
+	// settings_writing stays set until the record is complete
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		if (settings_dirty) {
+			if (settings_writing)
+				settings_again = TRUE;				// Picked up when the one in progress finishes
+			else
+				settings_start();
+		}
+	}
+}
+
+void snapshot_write(void) {
+	// Save the time and correction phase, called when the power fails and every so often after
+	// Goes ahead of a settings record that is being written, the half written one fails its CRC
+	// and is started over once the snapshot is down
+	uint32_t phase;
+	uint8_t i, crc = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		snapshot_seconds = rtc_seconds;
+		phase = correction_phase >> SNAPSHOT_PHASE_SHIFT;
+		snapshot_record[0] = snapshot_seconds;
+		snapshot_record[1] = snapshot_seconds >> 8;
+		snapshot_record[2] = snapshot_seconds >> 16;
+		snapshot_record[3] = snapshot_seconds >> 24;
+		snapshot_record[SNAPSHOT_PHASE] = phase;
+		snapshot_record[SNAPSHOT_PHASE + 1] = phase >> 8;
+		snapshot_record[SNAPSHOT_SEQ] = ++snapshot_seq;
+		for (i = 0; i < SNAPSHOT_CHECK; i++)
+			crc = _crc8_ccitt_update(crc, snapshot_record[i]);
+		snapshot_record[SNAPSHOT_CHECK] = crc;
+
+		if ((settings_writing) && (settings_write_data == settings_record))
+			settings_again = TRUE;
+		settings_write_data = snapshot_record;
+		settings_write_address = SNAPSHOT_BASE + (snapshot_slot * SNAPSHOT_SIZE);
+		settings_write_length = SNAPSHOT_SIZE;
+		settings_write_index = 0;
+		settings_writing = TRUE;
+		EECR |= (1 << EERIE);
+	}
+}
+
+void snapshot_task(void) {
+	// Keep the snapshot fresh while running from the supercap, so if it runs flat the time
+	// comes back at most SNAPSHOT_REFRESH seconds behind
+	if ((power_failed) && (!settings_writing) && (rtc_now() - snapshot_seconds >= SNAPSHOT_REFRESH))
+		snapshot_write();
+}
+
+uint8_t snapshot_init(void) {
+	// Find the newest good snapshot so the next one goes after it with a higher sequence number
+	// Every boot has to do this, returns FALSE if there isn't one
+	uint8_t slot, i, crc, seq;
+	uint8_t found = FALSE;
+	const uint8_t *address;
+
+	for (slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+		address = (const uint8_t *)(uintptr_t)(SNAPSHOT_BASE + (slot * SNAPSHOT_SIZE));
+		crc = 0;
+		for (i = 0; i < SNAPSHOT_CHECK; i++)
+			crc = _crc8_ccitt_update(crc, eeprom_read_byte(address + i));
+		if (crc != eeprom_read_byte(address + SNAPSHOT_CHECK))
+			continue;
+		seq = eeprom_read_byte(address + SNAPSHOT_SEQ);
+		if ((!found) || ((int8_t)(seq - snapshot_seq) > 0)) {
+			found = TRUE;
+			snapshot_slot = slot;
+			snapshot_seq = seq;
+		}
+	}
+	if (!found) {
+		snapshot_slot = 0;
+		return FALSE;
+	}
+
+	eeprom_read_block(snapshot_record, (const void *)(uintptr_t)(SNAPSHOT_BASE + (snapshot_slot * SNAPSHOT_SIZE)), SNAPSHOT_SIZE);
+	snapshot_slot = (snapshot_slot + 1) % SNAPSHOT_SLOTS;		// Next one goes after it
+	snapshot_seconds = (uint32_t)snapshot_record[0] | ((uint32_t)snapshot_record[1] << 8) |
+						((uint32_t)snapshot_record[2] << 16) | ((uint32_t)snapshot_record[3] << 24);
+	return TRUE;
+}
+
+uint8_t snapshot_restore(void) {
+	// Put the time back from the newest good snapshot, returns FALSE if there isn't one
+	if (!snapshot_init())
+		return FALSE;
+	rtc_restore(snapshot_seconds,
+				((uint32_t)snapshot_record[SNAPSHOT_PHASE] | ((uint32_t)snapshot_record[SNAPSHOT_PHASE + 1] << 8)) << SNAPSHOT_PHASE_SHIFT);
+	return TRUE;
+}